@@ -0,0 +1,104 @@
+#include "bitmap.h"
+
+#include "panic.h"
+
+static inline uint32_t bit_mask(uint32_t index){
+	return 0x80000000 >> (index & 31);
+}
+
+uint32_t HierarchicalBitmap::get_storage_words(uint32_t num_bits){
+	uint32_t total_words = 0;
+	uint32_t level_words;
+	
+	do {
+		level_words = (num_bits + 31) / 32;
+		total_words += level_words;
+		num_bits = level_words;
+	} while (level_words > 1);
+	
+	return total_words;
+}
+
+void HierarchicalBitmap::init(uint32_t * storage, uint32_t _num_bits){
+	num_bits = _num_bits;
+	num_levels = 0;
+	
+	uint32_t level_bits = num_bits;
+	uint32_t level_words;
+	
+	do {
+		if (num_levels == HIERARCHICAL_BITMAP_MAX_LEVELS){
+			panic(PanicCodes::IncompatibleParameter);
+		}
+		
+		level_words = (level_bits + 31) / 32;
+		levels[num_levels++] = storage;
+		
+		for (uint32_t i = 0; i < level_words; i++){
+			storage[i] = 0;
+		}
+		
+		storage += level_words;
+		level_bits = level_words;
+	} while (level_words > 1);
+}
+
+bool HierarchicalBitmap::test(uint32_t index){
+	return levels[0][index / 32] & bit_mask(index);
+}
+
+void HierarchicalBitmap::set(uint32_t index){
+	for (uint32_t level = 0; level < num_levels; level++){
+		uint32_t &word = levels[level][index / 32];
+		bool was_empty = (word == 0);
+		
+		word |= bit_mask(index);
+		
+		if (!was_empty){
+			//the summary bits above are already set
+			return;
+		}
+		index /= 32;
+	}
+}
+
+void HierarchicalBitmap::clear(uint32_t index){
+	for (uint32_t level = 0; level < num_levels; level++){
+		uint32_t &word = levels[level][index / 32];
+		
+		word &= ~bit_mask(index);
+		
+		if (word != 0){
+			//the summary bits above still need to be set
+			return;
+		}
+		index /= 32;
+	}
+}
+
+uint32_t HierarchicalBitmap::find_first(){
+	uint32_t index = 0;
+	
+	for (uint32_t level = num_levels; level-- > 0;){
+		uint32_t word = levels[level][index];
+		
+		if (word == 0){
+			//can only happen at the top level
+			return BITMAP_NOT_FOUND;
+		}
+		
+		index = index * 32 + __builtin_clz(word);
+	}
+	
+	return index;
+}
+
+uint32_t HierarchicalBitmap::count(){
+	uint32_t total = 0;
+	
+	for (uint32_t i = 0; i < (num_bits + 31) / 32; i++){
+		total += __builtin_popcount(levels[0][i]);
+	}
+	
+	return total;
+}
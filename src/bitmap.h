@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+
+const uint32_t BITMAP_NOT_FOUND = 0xffffffff;
+const uint32_t HIERARCHICAL_BITMAP_MAX_LEVELS = 5; //enough for 32^5 bits
+
+//a bitmap with summary levels above it: each bit in level n+1 is set if the corresponding word in level n is non-zero
+//bit i of a word is stored MSB-first, so clz on a word gives the lowest set index and find_first costs one word read per level
+class HierarchicalBitmap {
+private:
+	uint32_t * levels[HIERARCHICAL_BITMAP_MAX_LEVELS];
+	uint32_t num_levels;
+	uint32_t num_bits;
+public:
+	static uint32_t get_storage_words(uint32_t num_bits);
+	
+	void init(uint32_t * storage, uint32_t num_bits); //all bits start clear
+	
+	bool test(uint32_t index);
+	void set(uint32_t index);
+	void clear(uint32_t index);
+	
+	uint32_t find_first();
+	uint32_t count(); //number of set bits; walks the whole bottom level
+};
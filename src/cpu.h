@@ -0,0 +1,61 @@
+#pragma once
+
+#include "common.h"
+
+//per-context data is indexed by exception mode; there is only one core, so a context can only be
+//interrupted by a different context, never by itself
+//User and System mode share the Supervisor context
+enum class CpuContext : uint32_t {
+	Supervisor,
+	FIQ,
+	IRQ,
+	Abort,
+	Undefined,
+};
+
+const uint32_t NUM_CPU_CONTEXTS = 5;
+
+inline CpuContext cpu_get_context() {
+#ifdef HOST_BUILD
+	return CpuContext::Supervisor;
+#else
+	uint32_t cpsr;
+	asm volatile("mrs %[cpsr], cpsr" : [cpsr] "=r" (cpsr));
+
+	switch (cpsr & 0x1f) {
+		case 0x11:
+			return CpuContext::FIQ;
+		case 0x12:
+			return CpuContext::IRQ;
+		case 0x17:
+			return CpuContext::Abort;
+		case 0x1b:
+			return CpuContext::Undefined;
+		default:
+			return CpuContext::Supervisor;
+	}
+#endif
+}
+
+//masks IRQs and FIQs for its lifetime, restoring the previous state afterwards
+//on a single core this makes a short read-modify-write atomic with respect to every other context
+class InterruptGuard {
+	uint32_t saved_cpsr;
+public:
+	InterruptGuard() {
+#ifndef HOST_BUILD
+		asm volatile(
+			"mrs %[cpsr], cpsr\n"
+			"cpsid if"
+			: [cpsr] "=r" (saved_cpsr) : : "memory");
+#endif
+	}
+
+	~InterruptGuard() {
+#ifndef HOST_BUILD
+		asm volatile("msr cpsr_c, %[cpsr]" : : [cpsr] "r" (saved_cpsr) : "memory");
+#endif
+	}
+
+	InterruptGuard(const InterruptGuard &other) = delete;
+};
@@ -0,0 +1,146 @@
+#include "host_platform.h"
+#include "bitmap.h"
+#include "page_alloc.h"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+//cost of finding a free page, pagetable, section or supersection in 512MiB of simulated RAM:
+//the original byte-per-page refcount scan against a search of the per-order free bitmaps
+
+const uint32_t NUM_PAGES = SIM_RAM_SIZE / PAGE_SIZE;
+const uint32_t FILL_LEVELS[] = {0, 50, 90, 99};
+const uint32_t BLOCK_SIZES[] = {1, 4, 256, 4096};
+const uint32_t NUM_LOOKUPS = 2000;
+
+static std::vector<uint8_t> refcounts(NUM_PAGES);
+static std::vector<uint32_t> bitmap_storage;
+static HierarchicalBitmap free_blocks[PAGE_ALLOC_NUM_ORDERS];
+
+//the search PageAlloc::alloc used to do, starting from a cursor; returns the first page of the block
+static uint32_t scan_for_block(uint32_t start, uint32_t size){
+	uint32_t entry = start;
+	do {
+		bool all_refcounts_zero = true;
+		for (uint32_t i = 0; i < size; i++) {
+			if (refcounts[entry+i] != 0) {
+				all_refcounts_zero = false;
+			}
+		}
+		if (all_refcounts_zero) {
+			return entry;
+		}
+		entry += size;
+		if (entry >= NUM_PAGES){
+			entry -= NUM_PAGES;
+		}
+	} while (entry != start);
+
+	return 0xffffffff;
+}
+
+static uint32_t bitmap_find_block(uint32_t size){
+	for (uint32_t order = __builtin_ctz(size); order < PAGE_ALLOC_NUM_ORDERS; order++){
+		uint32_t block_ix = free_blocks[order].find_first();
+		if (block_ix != BITMAP_NOT_FOUND){
+			return block_ix << order;
+		}
+	}
+	return 0xffffffff;
+}
+
+//builds the free bitmaps the buddy allocator would have for the current refcounts
+static void build_bitmaps(){
+	uint32_t * storage = bitmap_storage.data();
+	for (uint32_t order = 0; order < PAGE_ALLOC_NUM_ORDERS; order++){
+		free_blocks[order].init(storage, NUM_PAGES >> order);
+		storage += HierarchicalBitmap::get_storage_words(NUM_PAGES >> order);
+	}
+
+	uint32_t page_ix = 0;
+	while (page_ix < NUM_PAGES){
+		if (refcounts[page_ix]){
+			page_ix++;
+			continue;
+		}
+
+		uint32_t order = PAGE_ALLOC_MAX_ORDER;
+		while (true){
+			bool fits = !(page_ix & ((1 << order) - 1)) && page_ix + (1 << order) <= NUM_PAGES;
+			for (uint32_t i = 0; fits && i < (1u << order); i++){
+				fits = !refcounts[page_ix + i];
+			}
+			if (fits) break;
+			order--;
+		}
+		free_blocks[order].set(page_ix >> order);
+		page_ix += 1 << order;
+	}
+}
+
+static void fill(uint32_t fill_percent, bool scattered, std::mt19937 &rng){
+	uint32_t used_pages = (uint64_t)NUM_PAGES * fill_percent / 100;
+
+	for (uint32_t i = 0; i < NUM_PAGES; i++){
+		refcounts[i] = (!scattered && i < used_pages) ? 1 : 0;
+	}
+
+	if (scattered){
+		std::uniform_int_distribution<uint32_t> page_dist(0, NUM_PAGES - 1);
+		for (uint32_t filled = 0; filled < used_pages;){
+			uint32_t page_ix = page_dist(rng);
+			if (!refcounts[page_ix]){
+				refcounts[page_ix] = 1;
+				filled++;
+			}
+		}
+	}
+}
+
+int main(){
+	uint32_t storage_words = 0;
+	for (uint32_t order = 0; order < PAGE_ALLOC_NUM_ORDERS; order++){
+		storage_words += HierarchicalBitmap::get_storage_words(NUM_PAGES >> order);
+	}
+	bitmap_storage.resize(storage_words);
+
+	printf("bitmap storage %u bytes, refcount table %u bytes\n", storage_words * 4, NUM_PAGES);
+	printf("layout\tfill\tpages\tscan ns/op\tbitmap ns/op\n");
+
+	std::mt19937 rng(1);
+
+	for (bool scattered : {false, true}){
+		for (uint32_t fill_percent : FILL_LEVELS){
+			fill(fill_percent, scattered, rng);
+			build_bitmaps();
+
+			for (uint32_t size : BLOCK_SIZES){
+				std::uniform_int_distribution<uint32_t> cursor_dist(0, NUM_PAGES / size - 1);
+				std::vector<uint32_t> cursors(NUM_LOOKUPS);
+				for (uint32_t &cursor : cursors){
+					cursor = cursor_dist(rng) * size;
+				}
+				volatile uint32_t sink = 0;
+
+				uint64_t start = host_time_ns();
+				for (uint32_t i = 0; i < NUM_LOOKUPS; i++){
+					sink = scan_for_block(cursors[i], size);
+				}
+				uint64_t scan_time = host_time_ns() - start;
+
+				start = host_time_ns();
+				for (uint32_t i = 0; i < NUM_LOOKUPS; i++){
+					sink = bitmap_find_block(size);
+				}
+				uint64_t bitmap_time = host_time_ns() - start;
+				(void)sink;
+
+				printf("%s\t%3u%%\t%4u\t%.1f\t%.1f\n", scattered ? "scatter" : "packed", fill_percent, size,
+					(double)scan_time / NUM_LOOKUPS, (double)bitmap_time / NUM_LOOKUPS);
+			}
+		}
+	}
+
+	return 0;
+}
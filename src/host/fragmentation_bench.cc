@@ -0,0 +1,135 @@
+#include "host_platform.h"
+#include "page_alloc.h"
+#include "pagetable.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <new>
+#include <random>
+#include <vector>
+
+//a long uptime: the short-lived working set repeatedly grows to fill most of memory and shrinks again, while a trickle
+//of long-lived pages is pinned along the way
+//run once with the short-lived pages allocated as movable and once with everything unmovable (no grouping),
+//reporting how much of the free memory is still available as sections and supersections
+//then, with every other page in most pageblocks owned by a reference-counted table, sections are allocated until
+//memory runs out, each one that isn't free having to be made by compaction
+
+const uint32_t PEAK_PERCENT = 90;
+const uint32_t PIN_INTERVAL = 500; //one pinned page per this many short-lived pages
+const uint32_t CYCLES = 20;
+
+alignas(PageAlloc) static uint8_t page_alloc_storage[sizeof(PageAlloc)];
+
+static void print_stats(const char * when, PageAlloc &page_alloc){
+	MemStats stats = page_alloc.get_mem_stats();
+	uint32_t free_sections = (uint64_t)stats.freemem * (1000 - stats.section_fragmentation) / 1000 / SECTION_SIZE;
+	uint32_t free_supersections = (uint64_t)stats.freemem * (1000 - stats.supersection_fragmentation) / 1000 / SUPERSECTION_SIZE;
+
+	printf("\t%s: free %u KiB, fragmentation section %u/1000 supersection %u/1000, free sections %u supersections %u\n",
+		when, stats.freemem / 1024, stats.section_fragmentation, stats.supersection_fragmentation, free_sections, free_supersections);
+}
+
+static void bench_uptime(bool grouped){
+	PageAlloc &page_alloc = *new (page_alloc_storage) PageAlloc(SIM_RAM_SIZE, (PageFrame*)SIM_TABLE_LOCATION);
+	PageMobility short_lived = grouped ? PageMobility::Movable : PageMobility::Unmovable;
+
+	uint32_t total_pages = SIM_RAM_SIZE / PAGE_SIZE;
+	uint32_t peak_pages = (uint64_t)total_pages * PEAK_PERCENT / 100;
+
+	std::mt19937 rng(1);
+	std::vector<uintptr_t> working_set;
+	std::vector<uintptr_t> pinned;
+
+	for (uint32_t cycle = 0; cycle < CYCLES; cycle++){
+		while (page_alloc.get_mem_stats().usedmem / PAGE_SIZE < peak_pages){
+			for (uint32_t i = 0; i < PIN_INTERVAL; i++){
+				working_set.push_back(page_alloc.alloc(1, short_lived));
+			}
+			pinned.push_back(page_alloc.alloc(1, PageMobility::Unmovable));
+		}
+
+		//shrink to a random tenth of the working set
+		std::shuffle(working_set.begin(), working_set.end(), rng);
+		while (working_set.size() > peak_pages / 10){
+			page_alloc.ref_release(working_set.back());
+			working_set.pop_back();
+		}
+	}
+
+	printf("%s:\n", grouped ? "grouped by mobility" : "ungrouped");
+	print_stats("after shrinking", page_alloc);
+
+	for (uintptr_t page : working_set){
+		page_alloc.ref_release(page);
+	}
+	print_stats("only pinned pages left", page_alloc);
+
+	page_alloc.~PageAlloc();
+}
+
+static void bench_compaction(){
+	PageAlloc &page_alloc = *new (page_alloc_storage) PageAlloc(SIM_RAM_SIZE, (PageFrame*)SIM_TABLE_LOCATION);
+	PageTable * table = new PageTable(page_alloc, false, true);
+
+	//page reservations can't span a second-level table, so reserve a section's worth at a time
+	std::vector<uintptr_t> table_pages;
+	while (table_pages.size() < (SIM_RAM_SIZE / PAGE_SIZE) * 4 / 10){
+		uintptr_t base = table->reserve(PAGES_IN_SECTION, AllocationGranularity::Page).value;
+		for (uint32_t i = 0; i < PAGES_IN_SECTION; i++){
+			table_pages.push_back(base + i * PAGE_SIZE);
+		}
+	}
+
+	//interleave the table's pages with pages that are freed again
+	std::vector<uintptr_t> spacers;
+	for (uintptr_t virtual_address : table_pages){
+		table->allocate(virtual_address, 1, AllocationGranularity::Page);
+		spacers.push_back(page_alloc.alloc(1, PageMobility::Movable));
+	}
+	for (uintptr_t page : spacers){
+		page_alloc.ref_release(page);
+	}
+
+	//tag each page with its address so the moves can be checked
+	for (uintptr_t virtual_address : table_pages){
+		*(uintptr_t*)table->virtual_to_physical(virtual_address).value = virtual_address;
+	}
+
+	printf("compaction:\n");
+	print_stats("before", page_alloc);
+
+	std::vector<uintptr_t> sections;
+	uint64_t slowest = 0;
+	uint64_t start = host_time_ns();
+	while (page_alloc.get_mem_stats().freemem >= 2 * SECTION_SIZE){
+		uint64_t alloc_start = host_time_ns();
+		sections.push_back(page_alloc.alloc(256));
+		slowest = std::max(slowest, host_time_ns() - alloc_start);
+	}
+	uint64_t total_time = host_time_ns() - start;
+
+	uint32_t corrupt = 0;
+	for (uintptr_t virtual_address : table_pages){
+		if (*(uintptr_t*)table->virtual_to_physical(virtual_address).value != virtual_address){
+			corrupt++;
+		}
+	}
+
+	printf("\tallocated %zu sections in %.1f ms, slowest %.1f us, %u moved pages corrupt\n",
+		sections.size(), total_time / 1000000.0, slowest / 1000.0, corrupt);
+	print_stats("after", page_alloc);
+
+	delete table;
+	page_alloc.~PageAlloc();
+}
+
+int main(){
+	sim_ram_init(SIM_RAM_SIZE);
+
+	bench_uptime(false);
+	bench_uptime(true);
+	bench_compaction();
+
+	return 0;
+}
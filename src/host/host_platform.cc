@@ -0,0 +1,64 @@
+#include "host_platform.h"
+
+#include "mmio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+
+const uint32_t UART0_DR = 0x20201000;
+
+//just enough of the UART for uart.cc to write to stderr, keeping stdout for results
+void mmio_write(uint32_t reg, uint32_t data){
+	if (reg == UART0_DR){
+		fputc(data, stderr);
+	}
+}
+
+uint32_t mmio_read(uint32_t reg){
+	(void)reg;
+	return 0; //FIFOs never full or empty
+}
+
+void sim_ram_init(uint32_t size){
+	//page 0 stays unmapped to catch null dereferences; the allocator never hands it out
+	void * base = mmap((void*)PAGE_SIZE, size - PAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_POPULATE, -1, 0);
+	
+	if (base != (void*)PAGE_SIZE){
+		fprintf(stderr, "Failed to map simulated RAM at %p\n", (void*)PAGE_SIZE);
+		exit(1);
+	}
+}
+
+uint64_t host_time_ns(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void print_latency_header(){
+	printf("%-40s %8s %9s %9s %9s %9s %9s\n", "operation", "count", "mean ns", "p50", "p90", "p99", "max");
+}
+
+void print_latency(const char * name, std::vector<uint64_t> &samples_ns){
+	if (samples_ns.empty()){
+		printf("%-40s %8s\n", name, "-");
+		return;
+	}
+	
+	std::sort(samples_ns.begin(), samples_ns.end());
+	
+	uint64_t total = 0;
+	for (uint64_t sample : samples_ns){
+		total += sample;
+	}
+	
+	auto percentile = [&](uint32_t p){
+		return samples_ns[std::min(samples_ns.size() - 1, samples_ns.size() * p / 100)];
+	};
+	
+	printf("%-40s %8zu %9.1f %9lu %9lu %9lu %9lu\n", name, samples_ns.size(), (double)total / samples_ns.size(),
+		percentile(50), percentile(90), percentile(99), samples_ns.back());
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+
+//physical memory is simulated by mapping an anonymous region at the same (low) addresses that
+//the allocator hands out, so physical addresses can be dereferenced exactly as they are on the target
+const uint32_t SIM_RAM_SIZE = 512 * 1024 * 1024;
+const uintptr_t SIM_TABLE_LOCATION = 0x00040000; //where the linker would put __page_alloc_table_start
+
+void sim_ram_init(uint32_t size);
+
+uint64_t host_time_ns();
+
+//prints one line of count, mean and percentiles for a set of per-operation timings (sorting them)
+//columns are those printed by print_latency_header
+void print_latency_header();
+void print_latency(const char * name, std::vector<uint64_t> &samples_ns);
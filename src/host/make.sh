@@ -0,0 +1,48 @@
+#builds the memory subsystem for the host against simulated physical RAM
+#run_tests runs the loader's RUN_TESTS tests, memory_bench times the main calls; "sh make.sh test" also runs the tests
+#size_class_tuner fits kmalloc_size_classes.h to a size histogram
+CXXFLAGS="-DHOST_BUILD -fno-exceptions -fno-rtti -g -O2 -std=c++17 -Wall -Wextra -I.. -I."
+
+mkdir -p build
+rm -f build/*.o
+rm -f run_tests memory_bench kmalloc_bench page_alloc_bench bitmap_bench pagetable_bench fragmentation_bench size_class_tuner
+
+g++ $CXXFLAGS -c ../utility.cc -o build/utility.o
+g++ $CXXFLAGS -c ../uart.cc -o build/uart.o
+g++ $CXXFLAGS -c ../panic.cc -o build/panic.o
+g++ $CXXFLAGS -c ../spinlock.cc -o build/spinlock.o
+g++ $CXXFLAGS -c ../bitmap.cc -o build/bitmap.o
+g++ $CXXFLAGS -c ../page_alloc.cc -o build/page_alloc.o
+g++ $CXXFLAGS -c ../pagetable.cc -o build/pagetable.o
+g++ $CXXFLAGS -c ../reverse_map.cc -o build/reverse_map.o
+g++ $CXXFLAGS -c ../slab.cc -o build/slab.o
+g++ $CXXFLAGS -c ../kmalloc.cc -o build/kmalloc.o
+g++ $CXXFLAGS -c ../page_alloc_tests.cc -o build/page_alloc_tests.o
+g++ $CXXFLAGS -c ../pagetable_tests.cc -o build/pagetable_tests.o
+g++ $CXXFLAGS -c ../slab_tests.cc -o build/slab_tests.o
+g++ $CXXFLAGS -c ../kmalloc_tests.cc -o build/kmalloc_tests.o
+g++ $CXXFLAGS -c ../object_cache_tests.cc -o build/object_cache_tests.o
+g++ $CXXFLAGS -c host_platform.cc -o build/host_platform.o
+g++ $CXXFLAGS -c run_tests.cc -o build/run_tests.o
+g++ $CXXFLAGS -c memory_bench.cc -o build/memory_bench.o
+g++ $CXXFLAGS -c kmalloc_bench.cc -o build/kmalloc_bench.o
+g++ $CXXFLAGS -c page_alloc_bench.cc -o build/page_alloc_bench.o
+g++ $CXXFLAGS -c bitmap_bench.cc -o build/bitmap_bench.o
+g++ $CXXFLAGS -c pagetable_bench.cc -o build/pagetable_bench.o
+g++ $CXXFLAGS -c fragmentation_bench.cc -o build/fragmentation_bench.o
+g++ $CXXFLAGS -c size_class_tuner.cc -o build/size_class_tuner.o
+
+OBJECTS="build/utility.o build/uart.o build/panic.o build/spinlock.o build/bitmap.o build/page_alloc.o build/pagetable.o build/reverse_map.o build/slab.o build/kmalloc.o build/host_platform.o"
+
+g++ -o run_tests $OBJECTS build/page_alloc_tests.o build/pagetable_tests.o build/slab_tests.o build/kmalloc_tests.o build/object_cache_tests.o build/run_tests.o
+g++ -o memory_bench $OBJECTS build/memory_bench.o
+g++ -o kmalloc_bench $OBJECTS build/kmalloc_bench.o
+g++ -o page_alloc_bench $OBJECTS build/page_alloc_bench.o
+g++ -o bitmap_bench $OBJECTS build/bitmap_bench.o
+g++ -o pagetable_bench $OBJECTS build/pagetable_bench.o
+g++ -o fragmentation_bench $OBJECTS build/fragmentation_bench.o
+g++ -o size_class_tuner $OBJECTS build/size_class_tuner.o
+
+if [ "$1" = "test" ]; then
+	./run_tests 2>/dev/null
+fi
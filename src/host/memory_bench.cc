@@ -0,0 +1,184 @@
+#include "host_platform.h"
+#include "page_alloc.h"
+#include "pagetable.h"
+
+#include <cstdio>
+#include <new>
+#include <random>
+#include <vector>
+
+//per-operation latency of the memory subsystem's main calls, each timed individually so that percentiles can be
+//reported; every figure includes the cost of reading the clock, which is shown on the first line
+
+alignas(PageAlloc) static uint8_t page_alloc_storage[sizeof(PageAlloc)];
+
+static PageAlloc &new_page_alloc(){
+	return *new (page_alloc_storage) PageAlloc(SIM_RAM_SIZE, (PageFrame*)SIM_TABLE_LOCATION);
+}
+
+static void bench_timer(){
+	std::vector<uint64_t> samples;
+	for (uint32_t i = 0; i < 10000; i++){
+		uint64_t start = host_time_ns();
+		samples.push_back(host_time_ns() - start);
+	}
+	print_latency("timer overhead", samples);
+}
+
+static void bench_alloc_free(){
+	const struct {
+		uint32_t size;
+		uint32_t count;
+	} configs[] = {{1, 8192}, {4, 2048}, {256, 256}, {4096, 16}};
+
+	PageAlloc &page_alloc = new_page_alloc();
+
+	for (auto config : configs){
+		std::vector<uintptr_t> blocks(config.count);
+		std::vector<uint64_t> alloc_samples;
+		std::vector<uint64_t> free_samples;
+
+		for (uint32_t i = 0; i < config.count; i++){
+			uint64_t start = host_time_ns();
+			blocks[i] = page_alloc.alloc(config.size);
+			alloc_samples.push_back(host_time_ns() - start);
+		}
+		for (uint32_t i = 0; i < config.count; i++){
+			uint64_t start = host_time_ns();
+			page_alloc.ref_release_range(blocks[i], config.size);
+			free_samples.push_back(host_time_ns() - start);
+		}
+
+		char name[64];
+		snprintf(name, sizeof(name), "alloc(%u)", config.size);
+		print_latency(name, alloc_samples);
+		snprintf(name, sizeof(name), "ref_release_range(%u)", config.size);
+		print_latency(name, free_samples);
+	}
+
+	{
+		std::vector<uintptr_t> pages(ZEROED_POOL_TARGET);
+		std::vector<uint64_t> samples;
+
+		page_alloc.refill_zeroed_pool(ZEROED_POOL_TARGET);
+		for (uint32_t i = 0; i < ZEROED_POOL_TARGET; i++){
+			uint64_t start = host_time_ns();
+			pages[i] = page_alloc.alloc_zeroed(1);
+			samples.push_back(host_time_ns() - start);
+		}
+		for (uintptr_t page : pages){
+			page_alloc.ref_release(page);
+		}
+		print_latency("alloc_zeroed(1) from the pool", samples);
+	}
+
+	page_alloc.~PageAlloc();
+}
+
+static void bench_reserve(){
+	const struct {
+		const char * name;
+		uint32_t units;
+		AllocationGranularity granularity;
+		uint32_t count;
+	} configs[] = {
+		{"reserve(1 page)", 1, AllocationGranularity::Page, 8192},
+		{"reserve(16 pages)", 16, AllocationGranularity::Page, 1024},
+		{"reserve(1 section)", 1, AllocationGranularity::Section, 512},
+		{"reserve(1 supersection)", 1, AllocationGranularity::Supersection, 16},
+	};
+
+	PageAlloc &page_alloc = new_page_alloc();
+
+	for (auto config : configs){
+		PageTable * table = new PageTable(page_alloc, true);
+		std::vector<uint64_t> samples;
+
+		for (uint32_t i = 0; i < config.count; i++){
+			uint64_t start = host_time_ns();
+			table->reserve(config.units, config.granularity);
+			samples.push_back(host_time_ns() - start);
+		}
+		print_latency(config.name, samples);
+
+		delete table;
+	}
+
+	page_alloc.~PageAlloc();
+}
+
+//maps, translates and tears down NUM_TABLES tables of PAGES_PER_TABLE pages each
+static void bench_map_translate_teardown(){
+	const uint32_t NUM_TABLES = 32;
+	const uint32_t PAGES_PER_TABLE = 2048;
+	const uint32_t NUM_LOOKUPS = 100000;
+
+	PageAlloc &page_alloc = new_page_alloc();
+	std::vector<uint64_t> map_samples;
+	std::vector<uint64_t> allocate_samples;
+	std::vector<uint64_t> lookup_samples;
+	std::vector<uint64_t> teardown_samples;
+	std::mt19937 rng(1);
+
+	for (uint32_t t = 0; t < NUM_TABLES; t++){
+		PageTable * table = new PageTable(page_alloc, false, true);
+		std::vector<uintptr_t> virtual_addresses;
+
+		//half mapped onto pages allocated here, half allocated by the table
+		for (uint32_t i = 0; i < PAGES_PER_TABLE / PAGES_IN_SECTION; i++){
+			uintptr_t base = table->reserve(PAGES_IN_SECTION, AllocationGranularity::Page).value;
+
+			for (uint32_t j = 0; j < PAGES_IN_SECTION; j++){
+				uintptr_t virtual_address = base + j * PAGE_SIZE;
+
+				if (j & 1){
+					uintptr_t page = page_alloc.alloc(1);
+
+					uint64_t start = host_time_ns();
+					table->map(virtual_address, page, 1, AllocationGranularity::Page);
+					map_samples.push_back(host_time_ns() - start);
+
+					page_alloc.ref_release(page); //the table holds the only reference now
+				} else {
+					uint64_t start = host_time_ns();
+					table->allocate(virtual_address, 1, AllocationGranularity::Page);
+					allocate_samples.push_back(host_time_ns() - start);
+				}
+
+				virtual_addresses.push_back(virtual_address);
+			}
+		}
+
+		std::uniform_int_distribution<uint32_t> address_dist(0, virtual_addresses.size() - 1);
+		for (uint32_t i = 0; i < NUM_LOOKUPS / NUM_TABLES; i++){
+			uintptr_t virtual_address = virtual_addresses[address_dist(rng)] + (i & 0xfff);
+
+			uint64_t start = host_time_ns();
+			table->virtual_to_physical(virtual_address);
+			lookup_samples.push_back(host_time_ns() - start);
+		}
+
+		uint64_t start = host_time_ns();
+		delete table;
+		teardown_samples.push_back(host_time_ns() - start);
+	}
+
+	print_latency("map(1 page)", map_samples);
+	print_latency("allocate(1 page)", allocate_samples);
+	print_latency("virtual_to_physical", lookup_samples);
+	print_latency("~PageTable (2048 pages)", teardown_samples);
+
+	page_alloc.~PageAlloc();
+}
+
+int main(){
+	sim_ram_init(SIM_RAM_SIZE);
+
+	print_latency_header();
+	bench_timer();
+	bench_alloc_free();
+	bench_reserve();
+	bench_map_translate_teardown();
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include "host_platform.h"
+#include "page_alloc.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <new>
+#include <vector>
+
+//alloc/release latency against how full memory is
+//memory is filled with single pages first, then blocks of each size are allocated and released in batches
+
+const uint32_t FILL_LEVELS[] = {0, 25, 50, 75, 90, 95, 99};
+const uint32_t BLOCK_SIZES[] = {1, 4, 256, 4096};
+const uint32_t MAX_BATCH = 1024;
+
+alignas(PageAlloc) static uint8_t page_alloc_storage[sizeof(PageAlloc)];
+
+static void bench_fill_level(uint32_t fill_percent){
+	PageAlloc &page_alloc = *new (page_alloc_storage) PageAlloc(SIM_RAM_SIZE, (PageFrame*)SIM_TABLE_LOCATION);
+
+	MemStats stats = page_alloc.get_mem_stats();
+	uint32_t total_pages = stats.totalmem / PAGE_SIZE;
+	uint32_t used_pages = stats.usedmem / PAGE_SIZE;
+	uint32_t target_pages = (uint64_t)total_pages * fill_percent / 100;
+
+	std::vector<uintptr_t> filler;
+	while (used_pages < target_pages){
+		filler.push_back(page_alloc.alloc(1));
+		used_pages++;
+	}
+
+	for (uint32_t size : BLOCK_SIZES){
+		uint32_t free_pages = total_pages - used_pages;
+		uint32_t batch = std::min(MAX_BATCH, free_pages / size / 2);
+
+		printf("%3u%%\t%4u\t", fill_percent, size);
+		if (batch == 0){
+			printf("-\t-\n");
+			continue;
+		}
+
+		uintptr_t blocks[MAX_BATCH];
+
+		uint64_t start = host_time_ns();
+		for (uint32_t i = 0; i < batch; i++){
+			blocks[i] = page_alloc.alloc(size);
+		}
+		uint64_t alloc_time = host_time_ns() - start;
+
+		start = host_time_ns();
+		for (uint32_t i = 0; i < batch; i++){
+			page_alloc.ref_release_range(blocks[i], size);
+		}
+		uint64_t release_time = host_time_ns() - start;
+
+		printf("%.1f\t%.1f\n", (double)alloc_time / batch, (double)release_time / batch);
+	}
+
+	for (uintptr_t page : filler){
+		page_alloc.ref_release(page);
+	}
+	
+	MagazineStats magazine_stats = page_alloc.get_magazine_stats();
+	printf("\tmagazine alloc hits %u misses %u, free hits %u misses %u\n",
+		magazine_stats.alloc_hits, magazine_stats.alloc_misses,
+		magazine_stats.free_hits, magazine_stats.free_misses);
+
+	page_alloc.~PageAlloc();
+}
+
+//alloc_zeroed(1) served from the pre-zeroed pool against zeroing inline
+static void bench_zeroed_pool(){
+	PageAlloc &page_alloc = *new (page_alloc_storage) PageAlloc(SIM_RAM_SIZE, (PageFrame*)SIM_TABLE_LOCATION);
+	uintptr_t pages[ZEROED_POOL_TARGET];
+	
+	page_alloc.refill_zeroed_pool(ZEROED_POOL_TARGET);
+	
+	uint64_t start = host_time_ns();
+	for (uint32_t i = 0; i < ZEROED_POOL_TARGET; i++){
+		pages[i] = page_alloc.alloc_zeroed(1);
+	}
+	uint64_t pooled_time = host_time_ns() - start;
+	
+	for (uint32_t i = 0; i < ZEROED_POOL_TARGET; i++){
+		page_alloc.ref_release(pages[i]);
+	}
+	
+	start = host_time_ns();
+	for (uint32_t i = 0; i < ZEROED_POOL_TARGET; i++){
+		pages[i] = page_alloc.alloc_zeroed(1);
+	}
+	uint64_t inline_time = host_time_ns() - start;
+	
+	printf("alloc_zeroed(1): pooled %.1f ns/op, inline %.1f ns/op\n",
+		(double)pooled_time / ZEROED_POOL_TARGET, (double)inline_time / ZEROED_POOL_TARGET);
+	
+	page_alloc.~PageAlloc();
+}
+
+int main(){
+	sim_ram_init(SIM_RAM_SIZE);
+
+	printf("fill\tpages\talloc ns/op\trelease ns/op\n");
+	for (uint32_t fill_percent : FILL_LEVELS){
+		bench_fill_level(fill_percent);
+	}
+	
+	bench_zeroed_pool();
+
+	return 0;
+}
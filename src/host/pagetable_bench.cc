@@ -0,0 +1,149 @@
+#include "host_platform.h"
+#include "page_alloc.h"
+#include "pagetable.h"
+#include "reverse_map.h"
+
+#include <cstdio>
+#include <new>
+#include <vector>
+
+//cost of mapping all of RAM with sections, as the loader does for identity_overlay
+//the loader's overlay isn't reference counted, so a reference-counted table is timed as well, mapping sections that
+//have been allocated; per-page refcounting (what map and ~PageTable did before the range calls) is shown alongside
+//then the cost of nonspecific reservations as an address space fills up with thousands of regions, a thousand at a time
+//and physical_to_virtual on a table mapping thousands of pages, walking the table and with a reverse map
+
+const uint32_t RESERVE_BENCH_REGIONS = 8000;
+const uint32_t RESERVE_BENCH_BATCH = 1000;
+const uint32_t LOOKUP_BENCH_SECTIONS = 16; //of pages
+
+
+alignas(PageAlloc) static uint8_t page_alloc_storage[sizeof(PageAlloc)];
+
+static void bench_reservations(PageAlloc &page_alloc, AllocationGranularity granularity, uint32_t max_units){
+	PageTable table(page_alloc, true);
+	
+	printf("nonspecific %s reservations of 1 to %u, ns each per %u:", (granularity == AllocationGranularity::Page) ? "page" : "section", max_units, RESERVE_BENCH_BATCH);
+	
+	uint32_t made = 0;
+	for (uint32_t batch = 0; batch < RESERVE_BENCH_REGIONS / RESERVE_BENCH_BATCH; batch++){
+		uint64_t start = host_time_ns();
+		for (uint32_t i = 0; i < RESERVE_BENCH_BATCH; i++){
+			made += table.reserve(1 + (made % max_units), granularity).is_success;
+		}
+		uint64_t batch_time = host_time_ns() - start;
+		
+		printf(" %.0f", (double)batch_time / RESERVE_BENCH_BATCH);
+	}
+	printf(" (%u made)\n", made);
+}
+
+static void bench_reverse_lookup(PageAlloc &page_alloc, bool reverse_mapped){
+	ReverseMap * reverse_map = reverse_mapped ? new ReverseMap(page_alloc) : nullptr;
+	PageTable * table = new PageTable(page_alloc, true, true, reverse_map);
+	
+	std::vector<uintptr_t> physical_addresses;
+	for (uint32_t i = 0; i < LOOKUP_BENCH_SECTIONS; i++){
+		uintptr_t base = table->reserve_allocate(PAGES_IN_SECTION, AllocationGranularity::Page).value;
+		for (uint32_t j = 0; j < PAGES_IN_SECTION; j++){
+			physical_addresses.push_back(table->virtual_to_physical(base + j * PAGE_SIZE).value);
+		}
+	}
+	
+	uint32_t found = 0;
+	uint64_t start = host_time_ns();
+	for (uintptr_t physical_address : physical_addresses){
+		found += table->physical_to_virtual(physical_address).is_success;
+	}
+	uint64_t lookup_time = host_time_ns() - start;
+	
+	printf("physical_to_virtual with %zu pages mapped, %s: %.1f ns each (%u found)\n", physical_addresses.size(),
+		reverse_mapped ? "reverse map" : "walking the table", (double)lookup_time / physical_addresses.size(), found);
+	
+	delete table;
+	delete reverse_map;
+}
+
+int main(){
+	sim_ram_init(SIM_RAM_SIZE);
+	PageAlloc &page_alloc = *new (page_alloc_storage) PageAlloc(SIM_RAM_SIZE, (PageFrame*)SIM_TABLE_LOCATION);
+
+	uint32_t nsections = get_num_allocation_units(SIM_RAM_SIZE, AllocationGranularity::Section);
+
+	{
+		uint64_t start = host_time_ns();
+		PageTable identity_overlay(page_alloc, false, false);
+		identity_overlay.reserve(0x00000000, nsections, AllocationGranularity::Section);
+		identity_overlay.map(0x00000000, 0x00000000, nsections, AllocationGranularity::Section);
+		uint64_t map_time = host_time_ns() - start;
+
+		printf("identity_overlay (not reference counted): map %u sections %.1f us\n", nsections, map_time / 1000.0);
+	}
+	
+	bench_reservations(page_alloc, AllocationGranularity::Page, 13);
+	bench_reservations(page_alloc, AllocationGranularity::Section, 1);
+	bench_reverse_lookup(page_alloc, false);
+	bench_reverse_lookup(page_alloc, true);
+
+	//all the sections that can be allocated, so that every page being mapped has a refcount
+	std::vector<uintptr_t> sections;
+	while (page_alloc.get_mem_stats().freemem >= 2 * SECTION_SIZE){
+		sections.push_back(page_alloc.alloc(256));
+	}
+	uint32_t npages = sections.size() * PAGES_IN_SECTION;
+
+	{
+		uint64_t start = host_time_ns();
+		for (uintptr_t section : sections){
+			for (uint32_t i = 0; i < PAGES_IN_SECTION; i++){
+				page_alloc.ref_acquire(section + i * PAGE_SIZE);
+			}
+		}
+		uint64_t acquire_time = host_time_ns() - start;
+
+		start = host_time_ns();
+		for (uintptr_t section : sections){
+			for (uint32_t i = 0; i < PAGES_IN_SECTION; i++){
+				page_alloc.ref_release(section + i * PAGE_SIZE);
+			}
+		}
+		uint64_t release_time = host_time_ns() - start;
+
+		printf("per-page refcounts for %u pages: acquire %.1f us, release %.1f us\n", npages, acquire_time / 1000.0, release_time / 1000.0);
+	}
+
+	{
+		uint64_t start = host_time_ns();
+		for (uintptr_t section : sections){
+			page_alloc.ref_acquire_range(section, PAGES_IN_SECTION);
+		}
+		uint64_t acquire_time = host_time_ns() - start;
+
+		start = host_time_ns();
+		for (uintptr_t section : sections){
+			page_alloc.ref_release_range(section, PAGES_IN_SECTION);
+		}
+		uint64_t release_time = host_time_ns() - start;
+
+		printf("range refcounts for %u pages: acquire %.1f us, release %.1f us\n", npages, acquire_time / 1000.0, release_time / 1000.0);
+	}
+
+	{
+		PageTable * table = new PageTable(page_alloc, false, true);
+
+		uint64_t start = host_time_ns();
+		for (uintptr_t section : sections){
+			table->reserve(section, 1, AllocationGranularity::Section);
+			table->map(section, section, 1, AllocationGranularity::Section);
+		}
+		uint64_t map_time = host_time_ns() - start;
+
+		start = host_time_ns();
+		delete table;
+		uint64_t teardown_time = host_time_ns() - start;
+
+		printf("reference-counted table: map %zu sections %.1f us, teardown %.1f us\n", sections.size(), map_time / 1000.0, teardown_time / 1000.0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,35 @@
+#include "host_platform.h"
+#include "page_alloc.h"
+#include "runtime_tests.h"
+
+#include <cstdio>
+#include <new>
+
+//the same tests the loader runs when built with RUN_TESTS, against simulated RAM
+//the per-test results go to stderr with the rest of the UART output; the exit status says whether they all passed
+
+alignas(PageAlloc) static uint8_t page_alloc_storage[sizeof(PageAlloc)];
+
+int main(){
+	sim_ram_init(SIM_RAM_SIZE);
+	PageAlloc &page_alloc = *new (page_alloc_storage) PageAlloc(SIM_RAM_SIZE, (PageFrame*)SIM_TABLE_LOCATION);
+	
+	page_alloc.refill_zeroed_pool(ZEROED_POOL_TARGET);
+	
+	bool all_passed = true;
+	
+	//non-short circuit
+	all_passed &= test_page_alloc(page_alloc);
+	all_passed &= test_pagetables(page_alloc);
+	all_passed &= test_slab(page_alloc);
+	all_passed &= test_kmalloc(page_alloc);
+	all_passed &= test_object_cache(page_alloc);
+	
+	if (all_passed){
+		printf("All tests passed\n");
+		return 0;
+	} else {
+		printf("Some tests failed\n");
+		return 1;
+	}
+}
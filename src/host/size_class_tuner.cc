@@ -0,0 +1,282 @@
+#include "host_platform.h"
+#include "page_alloc.h"
+#include "kmalloc.h"
+#include "pagetable.h"
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <random>
+#include <vector>
+
+//fits kmalloc's size classes to a histogram of request sizes, and reports the memory overhead of the current table
+//against the fitted one
+//the histogram is either read from a log holding the lines kmalloc_print_size_histogram prints on the target, or,
+//with no log given, recorded from a sample workload run through kmalloc here
+//with -o the fitted table is written out as a replacement for kmalloc_size_classes.h
+//overhead is counted per request: the bytes lost rounding up to the class, and the class's share of each slab's
+//header and leftover space; a bucket's requests are taken to be its largest size, so rounding within a bucket isn't
+//counted for either table
+//the fit has as many classes as the current table and picks them by dynamic programming over the buckets, so it is
+//the best table for the histogram under that measure; every bucket is given a little weight on top of what was
+//recorded, so that the classes left over are spread out rather than bunched where nothing was ever requested
+
+const uint32_t PRIOR_PERCENT = 1; //of the requests, spread over all buckets
+
+const uint32_t WORKLOAD_OPS = 2000000;
+const uint32_t WORKLOAD_WORKING_SET = 20000;
+
+alignas(PageAlloc) static uint8_t page_alloc_storage[sizeof(PageAlloc)];
+
+//something like the mix of a kernel's objects: list nodes and small control blocks, a few mid-sized structures,
+//and network-sized buffers, plus a tail of anything
+struct WorkloadSize {
+	uint32_t size;
+	uint32_t weight;
+};
+
+const WorkloadSize WORKLOAD_SIZES[] = {
+	{24, 300}, {40, 150}, {56, 100}, {72, 100}, {136, 80}, {200, 50}, {264, 50},
+	{520, 40}, {1100, 30}, {1514, 50}, {1600, 20}, {2048, 10},
+};
+const uint32_t WORKLOAD_ANY_SIZE_WEIGHT = 20;
+
+static void record_workload(std::vector<uint64_t> &histogram){
+	sim_ram_init(SIM_RAM_SIZE);
+	PageAlloc &page_alloc = *new (page_alloc_storage) PageAlloc(SIM_RAM_SIZE, (PageFrame*)SIM_TABLE_LOCATION);
+	PageTable * kernel_table = new PageTable(page_alloc, true);
+	kmalloc_init(page_alloc, *kernel_table);
+	kmalloc_set_sample_rate(0);
+	
+	std::vector<uint32_t> weights;
+	for (const WorkloadSize &entry : WORKLOAD_SIZES){
+		weights.push_back(entry.weight);
+	}
+	weights.push_back(WORKLOAD_ANY_SIZE_WEIGHT);
+	
+	std::mt19937 rng(5);
+	std::discrete_distribution<uint32_t> entry_dist(weights.begin(), weights.end());
+	std::uniform_int_distribution<uint32_t> any_size_dist(1, KMALLOC_MAX_SIZE);
+	std::uniform_int_distribution<uint32_t> victim_dist(0, WORKLOAD_WORKING_SET - 1);
+	
+	auto next_size = [&](){
+		uint32_t entry = entry_dist(rng);
+		return (entry < sizeof(WORKLOAD_SIZES) / sizeof(WORKLOAD_SIZES[0])) ? WORKLOAD_SIZES[entry].size : any_size_dist(rng);
+	};
+	
+	std::vector<void*> objects(WORKLOAD_WORKING_SET);
+	for (void * &object : objects){
+		object = kmalloc(next_size());
+	}
+	for (uint32_t i = 0; i < WORKLOAD_OPS; i++){
+		void * &object = objects[victim_dist(rng)];
+		kfree(object);
+		object = kmalloc(next_size());
+	}
+	for (void * object : objects){
+		kfree(object);
+	}
+	
+	std::vector<uint32_t> counts(KMALLOC_HISTOGRAM_BUCKETS);
+	kmalloc_get_size_histogram(counts.data());
+	for (uint32_t bucket = 0; bucket < KMALLOC_HISTOGRAM_BUCKETS; bucket++){
+		histogram[bucket] = counts[bucket];
+	}
+}
+
+static bool read_histogram(const char * path, std::vector<uint64_t> &histogram){
+	FILE * file = fopen(path, "r");
+	if (file == nullptr){
+		return false;
+	}
+	
+	char line[256];
+	while (fgets(line, sizeof(line), file) != nullptr){
+		const char * entry = strstr(line, "kmalloc histogram ");
+		unsigned size;
+		unsigned long long count;
+		
+		if (entry == nullptr || sscanf(entry, "kmalloc histogram %u %llu", &size, &count) != 2){
+			continue;
+		}
+		if (size == 0 || size > KMALLOC_MAX_SIZE){
+			continue;
+		}
+		histogram[(size - 1) / KMALLOC_GRANULE] += count;
+	}
+	
+	fclose(file);
+	return true;
+}
+
+static uint32_t bucket_size(uint32_t bucket){
+	return (bucket + 1) * KMALLOC_GRANULE;
+}
+
+//bytes of slab header and leftover space per object, for a class of this size
+static double slab_overhead(uint32_t object_size){
+	uint32_t slab_size = kmalloc_class_slab_pages(object_size) * PAGE_SIZE;
+	uint32_t objects_per_slab = (slab_size - slab_first_offset(kmalloc_class_alignment(object_size))) / object_size;
+	
+	return (double)(slab_size - objects_per_slab * object_size) / objects_per_slab;
+}
+
+struct TableOverhead {
+	uint64_t requests;
+	uint64_t requested_bytes;
+	double rounding_bytes;
+	double slab_bytes;
+};
+
+static TableOverhead measure_table(const std::vector<uint32_t> &table, const std::vector<uint64_t> &histogram){
+	TableOverhead retval = {0, 0, 0, 0};
+	uint32_t size_class = 0;
+	
+	for (uint32_t bucket = 0; bucket < KMALLOC_HISTOGRAM_BUCKETS; bucket++){
+		while (table[size_class] < bucket_size(bucket)){
+			size_class++;
+		}
+		
+		retval.requests += histogram[bucket];
+		retval.requested_bytes += histogram[bucket] * bucket_size(bucket);
+		retval.rounding_bytes += (double)histogram[bucket] * (table[size_class] - bucket_size(bucket));
+		retval.slab_bytes += histogram[bucket] * slab_overhead(table[size_class]);
+	}
+	
+	return retval;
+}
+
+static std::vector<uint32_t> fit_table(const std::vector<uint64_t> &histogram, uint32_t num_classes){
+	const uint32_t N = KMALLOC_HISTOGRAM_BUCKETS;
+	
+	uint64_t total = 0;
+	for (uint64_t count : histogram){
+		total += count;
+	}
+	double prior = (double)total * PRIOR_PERCENT / 100 / N;
+	
+	//prefix sums of the weight of each bucket, and of the weight times its size
+	std::vector<double> weight_sum(N + 1, 0);
+	std::vector<double> size_sum(N + 1, 0);
+	for (uint32_t bucket = 0; bucket < N; bucket++){
+		double weight = histogram[bucket] + prior;
+		weight_sum[bucket + 1] = weight_sum[bucket] + weight;
+		size_sum[bucket + 1] = size_sum[bucket] + weight * bucket_size(bucket);
+	}
+	
+	std::vector<double> overhead(N);
+	for (uint32_t bucket = 0; bucket < N; bucket++){
+		overhead[bucket] = slab_overhead(bucket_size(bucket));
+	}
+	
+	//the cost of buckets first to last all going to a class the size of the last one
+	auto cost = [&](uint32_t first, uint32_t last){
+		double weight = weight_sum[last + 1] - weight_sum[first];
+		return weight * (bucket_size(last) + overhead[last]) - (size_sum[last + 1] - size_sum[first]);
+	};
+	
+	//best[k][last]: the cheapest way to cover buckets 0 to last with k + 1 classes, the largest the size of last
+	std::vector<std::vector<double>> best(num_classes, std::vector<double>(N, 1e300));
+	std::vector<std::vector<uint32_t>> previous(num_classes, std::vector<uint32_t>(N, 0));
+	
+	for (uint32_t last = 0; last < N; last++){
+		best[0][last] = cost(0, last);
+	}
+	for (uint32_t k = 1; k < num_classes; k++){
+		for (uint32_t last = k; last < N; last++){
+			for (uint32_t split = k - 1; split < last; split++){
+				double candidate = best[k - 1][split] + cost(split + 1, last);
+				if (candidate < best[k][last]){
+					best[k][last] = candidate;
+					previous[k][last] = split;
+				}
+			}
+		}
+	}
+	
+	std::vector<uint32_t> table(num_classes);
+	uint32_t last = N - 1;
+	for (uint32_t k = num_classes; k-- > 0;){
+		table[k] = bucket_size(last);
+		last = previous[k][last];
+	}
+	
+	return table;
+}
+
+static void print_overhead(const char * name, const TableOverhead &overhead){
+	printf("%-8s table: %llu requests of %llu bytes, rounding %.0f bytes (%.2f%%), slabs %.0f bytes (%.2f%%), overhead %.2f%%\n",
+		name, (unsigned long long)overhead.requests, (unsigned long long)overhead.requested_bytes,
+		overhead.rounding_bytes, 100.0 * overhead.rounding_bytes / overhead.requested_bytes,
+		overhead.slab_bytes, 100.0 * overhead.slab_bytes / overhead.requested_bytes,
+		100.0 * (overhead.rounding_bytes + overhead.slab_bytes) / overhead.requested_bytes);
+}
+
+static bool write_table(const char * path, const std::vector<uint32_t> &table, const char * source){
+	FILE * file = fopen(path, "w");
+	if (file == nullptr){
+		return false;
+	}
+	
+	fprintf(file, "#pragma once\n\n#include \"common.h\"\n\n");
+	fprintf(file, "//the object sizes of kmalloc's size classes, smallest first: multiples of KMALLOC_GRANULE, ending at KMALLOC_MAX_SIZE\n");
+	fprintf(file, "//written by host/size_class_tuner, fitted to the size histogram from %s\n", source);
+	fprintf(file, "constexpr uint32_t KMALLOC_SIZE_CLASSES[] = {\n");
+	for (uint32_t i = 0; i < table.size(); i++){
+		fprintf(file, "%s%u,%s", (i % 16 == 0) ? "\t" : " ", table[i], (i % 16 == 15 || i + 1 == table.size()) ? "\n" : "");
+	}
+	fprintf(file, "};\n");
+	
+	fclose(file);
+	return true;
+}
+
+int main(int argc, char ** argv){
+	const char * log_path = nullptr;
+	const char * output_path = nullptr;
+	
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc){
+			output_path = argv[++i];
+		} else if (argv[i][0] != '-' && log_path == nullptr){
+			log_path = argv[i];
+		} else {
+			fprintf(stderr, "usage: %s [histogram log] [-o kmalloc_size_classes.h]\n", argv[0]);
+			return 2;
+		}
+	}
+	
+	std::vector<uint64_t> histogram(KMALLOC_HISTOGRAM_BUCKETS, 0);
+	if (log_path != nullptr){
+		if (!read_histogram(log_path, histogram)){
+			fprintf(stderr, "can't read %s\n", log_path);
+			return 1;
+		}
+	} else {
+		record_workload(histogram);
+	}
+	
+	std::vector<uint32_t> current(KMALLOC_SIZE_CLASSES, KMALLOC_SIZE_CLASSES + KMALLOC_NUM_SIZE_CLASSES);
+	std::vector<uint32_t> tuned = fit_table(histogram, KMALLOC_NUM_SIZE_CLASSES);
+	
+	TableOverhead current_overhead = measure_table(current, histogram);
+	if (current_overhead.requests == 0){
+		fprintf(stderr, "the histogram is empty\n");
+		return 1;
+	}
+	print_overhead("current", current_overhead);
+	print_overhead("tuned", measure_table(tuned, histogram));
+	
+	printf("tuned classes:");
+	for (uint32_t object_size : tuned){
+		printf(" %u", object_size);
+	}
+	printf("\n");
+	
+	if (output_path != nullptr && !write_table(output_path, tuned, log_path ? log_path : "the sample workload")){
+		fprintf(stderr, "can't write %s\n", output_path);
+		return 1;
+	}
+	
+	return 0;
+}
@@ -1,11 +1,25 @@
 #include "pagetable.h"
+#include "page_alloc.h"
+#include "kmalloc.h"
 #include "panic.h"
+#include "runtime_benchmarks.h"
 #include "uart.h"
 
+//#define RUN_BENCHMARKS
+
 extern "C"
-void kernel_entry(PageTable *identity_overlay, PageTable *supervisor_pagetable) {
+void kernel_entry(PageTable *identity_overlay, PageTable *supervisor_pagetable, PageAlloc *page_alloc) {
 	uart_puts("Running from higher-half\r\n");
 	
+	kmalloc_init(*page_alloc, *supervisor_pagetable);
+	
+#ifdef RUN_BENCHMARKS
+	bench_slab_coloring();
+	bench_kmalloc_aligned();
+	bench_section_heap(*page_alloc);
+	bench_virtual_to_physical(*supervisor_pagetable);
+#endif
+	
 	supervisor_pagetable->print_table_info();
 	
 	panic(PanicCodes::AssertionFailure);
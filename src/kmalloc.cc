@@ -1,102 +1,510 @@
 #include "kmalloc.h"
 
-#include <bitset>
-#include "page_alloc.h"
+#include "cpu.h"
+#include "pagetable.h"
 #include "panic.h"
+#include "slab.h"
+#include "uart.h"
 
-const size_t SMALL_HEAP_MAX_SIZE = 128;
-const size_t SMALL_HEAP_GRANULARITY = 4;
-const size_t SMALL_HEAP_NUM_SIZES = SMALL_HEAP_MAX_SIZE / SMALL_HEAP_GRANULARITY;
-const size_t SMALL_HEAP_MAX_ENTRIES = 1024;
-
-const size_t MEDIUM_HEAP_MAX_SIZE = 2048;
-const size_t MEDIUM_HEAP_GRANULARITY = 64;
-const size_t MEDIUM_HEAP_SCALE = 32;
-const size_t MEDIUM_HEAP_NUM_SIZES = MEDIUM_HEAP_MAX_SIZE / MEDIUM_HEAP_GRANULARITY;
-const size_t MEDIUM_HEAP_MAX_ENTRIES = 64;
-
-struct SmallHeapBlockHeader {
-	SmallHeapBlockHeader * next;
-	uint32_t free_entries;
-	std::bitset<SMALL_HEAP_MAX_ENTRIES> utilisation;
-	uint32_t entries[];
+constexpr bool size_classes_valid(){
+	uint32_t previous = 0;
+	
+	for (uint32_t object_size : KMALLOC_SIZE_CLASSES){
+		if (object_size <= previous || object_size % KMALLOC_GRANULE != 0){
+			return false;
+		}
+		previous = object_size;
+	}
+	
+	return previous == KMALLOC_MAX_SIZE;
+}
+
+static_assert(size_classes_valid(), "size classes must be increasing multiples of KMALLOC_GRANULE, up to KMALLOC_MAX_SIZE");
+static_assert(KMALLOC_NUM_SIZE_CLASSES <= 256, "the class lookup only holds 8 bits");
+
+//the size class of each histogram bucket, so that finding a request's class is one load
+struct SizeClassLookup {
+	uint8_t size_classes[KMALLOC_HISTOGRAM_BUCKETS];
 };
 
-struct MediumHeapBlockHeader {
-	MediumHeapBlockHeader * next;
-	uint32_t free_entries;
-	std::bitset<MEDIUM_HEAP_MAX_ENTRIES> utilisation;
-	uint32_t entries[];
+constexpr SizeClassLookup make_size_class_lookup(){
+	SizeClassLookup retval = {};
+	uint32_t size_class = 0;
+	
+	for (uint32_t bucket = 0; bucket < KMALLOC_HISTOGRAM_BUCKETS; bucket++){
+		if ((bucket + 1) * KMALLOC_GRANULE > KMALLOC_SIZE_CLASSES[size_class]){
+			size_class++;
+		}
+		retval.size_classes[bucket] = size_class;
+	}
+	
+	return retval;
+}
+
+static constexpr SizeClassLookup size_class_lookup = make_size_class_lookup();
+
+//anything bigger is given its own range of kernel virtual memory, backed by single pages that needn't be
+//physically contiguous; each range is followed by a guard page that is reserved but never committed, which
+//catches overruns
+const uintptr_t VMALLOC_START = 0xc0000000;
+const uintptr_t VMALLOC_END = 0xf0000000;
+const uint32_t VMALLOC_PAGES = (VMALLOC_END - VMALLOC_START) / PAGE_SIZE;
+
+//every size class carves its slabs out of the same few section-aligned blocks (see SlabSection), so that the whole
+//heap takes a handful of TLB entries
+const bool SECTION_BACKED_HEAP = true;
+
+//each CPU context keeps a magazine of free objects per size class in front of the shared slabs, so that most
+//allocations and frees only touch memory that no other context uses; an empty magazine is refilled with half its
+//capacity, and a full one gives back its oldest half, one lock round trip each
+//bigger objects are kept fewer at a time
+const uint32_t SMALL_MAGAZINE_SIZE = 16;
+const uint32_t MEDIUM_MAGAZINE_SIZE = 4;
+
+struct KmallocMagazine {
+	uint32_t count;
+	void * objects[SMALL_MAGAZINE_SIZE];
+	
+	uint32_t alloc_hits;
+	uint32_t alloc_misses; //refills
+	uint32_t free_hits;
+	uint32_t free_misses; //flushes
 };
 
-constexpr uint32_t small_heap_get_num_entries(size_t size){
-	return (PAGE_SIZE - sizeof(SmallHeapBlockHeader)) / size;
+static_assert(KMALLOC_SAMPLE_QUARANTINE_SIZE < KMALLOC_SAMPLED_SLOTS, "the quarantine would hold every slot");
+
+static PageTable * kmalloc_page_table = nullptr;
+static SlabCache caches[KMALLOC_NUM_SIZE_CLASSES];
+static KmallocMagazine magazines[NUM_CPU_CONTEXTS][KMALLOC_NUM_SIZE_CLASSES];
+static uint32_t size_histogram[NUM_CPU_CONTEXTS][KMALLOC_HISTOGRAM_BUCKETS];
+
+static uint32_t sample_rate;
+static uint32_t sample_countdown[NUM_CPU_CONTEXTS];
+static uint32_t sample_random[NUM_CPU_CONTEXTS];
+
+static Spinlock sample_spinlock_cs; //for the slots and the stats
+static uint16_t sample_free_slots[KMALLOC_SAMPLED_SLOTS]; //a stack
+static uint32_t sample_num_free_slots;
+static uint16_t sample_quarantine[KMALLOC_SAMPLE_QUARANTINE_SIZE]; //a ring, oldest first
+static uint32_t sample_quarantine_start;
+static KmallocSampleStats sample_stats;
+
+//a bit per page of the vmalloc range, set for the last page of each allocation, so that freeing it needn't walk the
+//table to find where it ends
+static uint32_t vmalloc_last_pages[VMALLOC_PAGES / 32];
+
+static uint32_t get_magazine_size(uint32_t size_class){
+	return (KMALLOC_SIZE_CLASSES[size_class] <= KMALLOC_SMALL_MAX_SIZE) ? SMALL_MAGAZINE_SIZE : MEDIUM_MAGAZINE_SIZE;
 }
 
-constexpr uint32_t medium_heap_get_num_pages(size_t size){
-	return (MEDIUM_HEAP_SCALE * size + PAGE_SIZE - 4) / PAGE_SIZE;
+void kmalloc_init(PageAlloc &page_alloc, PageTable &kernel_table){
+	slab_init(page_alloc);
+	kmalloc_page_table = &kernel_table;
+	
+	//a small slab's first object is on a cache line and a medium one's on a 64-byte boundary, so objects whose size is
+	//a multiple of that don't straddle more cache lines than they have to; every class is colored
+	for (uint32_t size_class = 0; size_class < KMALLOC_NUM_SIZE_CLASSES; size_class++){
+		uint32_t object_size = KMALLOC_SIZE_CLASSES[size_class];
+		
+		slab_cache_init(caches[size_class], object_size, kmalloc_class_slab_pages(object_size), kmalloc_class_alignment(object_size), true, SECTION_BACKED_HEAP);
+	}
+	
+	for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+		for (uint32_t size_class = 0; size_class < KMALLOC_NUM_SIZE_CLASSES; size_class++){
+			magazines[i][size_class] = KmallocMagazine();
+		}
+		for (uint32_t bucket = 0; bucket < KMALLOC_HISTOGRAM_BUCKETS; bucket++){
+			size_histogram[i][bucket] = 0;
+		}
+		sample_random[i] = 0x9e3779b9 * (i + 1);
+	}
+	
+	for (uint32_t i = 0; i < VMALLOC_PAGES / 32; i++){
+		vmalloc_last_pages[i] = 0;
+	}
+	
+	//every slot stays reserved from here on, so sampling only ever commits and decommits pages in second-level tables
+	//that are already there
+	if (!kernel_table.reserve(KMALLOC_SAMPLED_START, KMALLOC_SAMPLED_SLOTS * 2, AllocationGranularity::Page).is_success){
+		panic(PanicCodes::AssertionFailure);
+	}
+	
+	//handed out from the start of the range
+	for (uint32_t i = 0; i < KMALLOC_SAMPLED_SLOTS; i++){
+		sample_free_slots[i] = KMALLOC_SAMPLED_SLOTS - 1 - i;
+	}
+	sample_num_free_slots = KMALLOC_SAMPLED_SLOTS;
+	sample_quarantine_start = 0;
+	sample_stats = KmallocSampleStats{0, 0, 0, 0};
+	kmalloc_set_sample_rate(KMALLOC_DEFAULT_SAMPLE_RATE);
 }
 
-constexpr uint32_t medium_heap_get_num_entries(size_t size){
-	return (PAGE_SIZE * medium_heap_get_num_pages(size) - sizeof(SmallHeapBlockHeader)) / size;
+//interrupts are only masked for as long as the magazine is being used, which is what keeps a context's magazine
+//its own on a single core; refills and flushes hold the slab lock as well
+static void * magazine_alloc(uint32_t size_class){
+	InterruptGuard guard;
+	KmallocMagazine &magazine = magazines[(uint32_t)cpu_get_context()][size_class];
+	
+	if (magazine.count == 0){
+		magazine.alloc_misses++;
+		
+		magazine.count = get_magazine_size(size_class) / 2;
+		slab_cache_alloc_batch(caches[size_class], magazine.objects, magazine.count);
+	} else {
+		magazine.alloc_hits++;
+	}
+	
+	return magazine.objects[--magazine.count];
 }
 
-SmallBlockHeader * small_block_heap[SMALL_HEAP_NUM_SIZES] = {0};
-MediumBlockHeader * medium_block_heap[MEDIUM_HEAP_NUM_SIZES] = {0};
+static void magazine_free(uint32_t size_class, void * memory){
+	InterruptGuard guard;
+	KmallocMagazine &magazine = magazines[(uint32_t)cpu_get_context()][size_class];
+	uint32_t size = get_magazine_size(size_class);
+	
+	if (magazine.count == size){
+		magazine.free_misses++;
+		
+		//the oldest objects are the least likely to still be in the cache
+		uint32_t batch = size / 2;
+		slab_cache_free_batch(caches[size_class], magazine.objects, batch);
+		for (uint32_t i = batch; i < size; i++){
+			magazine.objects[i - batch] = magazine.objects[i];
+		}
+		magazine.count -= batch;
+	} else {
+		magazine.free_hits++;
+	}
+	
+	magazine.objects[magazine.count++] = memory;
+}
 
-void kmalloc_init(){
+//somewhere from 1 to 2 * sample_rate - 1 allocations, so that sampling doesn't fall into step with a caller
+static uint32_t next_sample_interval(uint32_t context){
+	uint32_t x = sample_random[context];
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sample_random[context] = x;
 	
+	return x % (2 * sample_rate - 1) + 1;
 }
 
-void * kmalloc(size_t size){
-	if (initial_size <= SMALL_HEAP_MAX_SIZE){
-		size_t alloc_size = (initial_size + SMALL_HEAP_GRANULARITY - 1) / SMALL_HEAP_GRANULARITY * SMALL_HEAP_GRANULARITY;
+void kmalloc_set_sample_rate(uint32_t rate){
+	InterruptGuard guard;
+	
+	sample_rate = rate;
+	for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+		sample_countdown[i] = (rate != 0) ? next_sample_interval(i) : 0;
+	}
+}
+
+//each context counts down on its own, so this needs neither atomics nor masked interrupts: a context is only ever
+//interrupted by a different one
+static bool sample_due(){
+	uint32_t context = (uint32_t)cpu_get_context();
+	
+	if (sample_countdown[context] == 0 || --sample_countdown[context] != 0){
+		return false;
+	}
+	
+	sample_countdown[context] = next_sample_interval(context);
+	return true;
+}
+
+static uintptr_t get_slot_address(uint32_t slot){
+	return KMALLOC_SAMPLED_START + slot * 2 * PAGE_SIZE;
+}
+
+//the lock must be held
+static void release_oldest_quarantined(){
+	uint16_t slot = sample_quarantine[sample_quarantine_start];
+	sample_quarantine_start = (sample_quarantine_start + 1) % KMALLOC_SAMPLE_QUARANTINE_SIZE;
+	sample_stats.quarantined--;
+	
+	//its page was decommitted when it was freed
+	sample_free_slots[sample_num_free_slots++] = slot;
+}
+
+static void * sampled_alloc(size_t size, size_t alignment){
+	InterruptGuard guard;
+	auto lock = sample_spinlock_cs.acquire();
+	
+	if (sample_num_free_slots == 0){
+		if (sample_stats.quarantined == 0){
+			sample_stats.failed++;
+			return nullptr;
+		}
+		release_oldest_quarantined();
+	}
+	
+	uintptr_t page = get_slot_address(sample_free_slots[--sample_num_free_slots]);
+	
+	if (!kmalloc_page_table->allocate(page, 1, AllocationGranularity::Page)){
+		panic(PanicCodes::AssertionFailure);
+	}
+	
+	sample_stats.sampled++;
+	sample_stats.live++;
+	
+	return (void*)(page + ((PAGE_SIZE - size) & ~(alignment - 1)));
+}
+
+static void sampled_free(uintptr_t page){
+	InterruptGuard guard;
+	auto lock = sample_spinlock_cs.acquire();
+	
+	//a page that isn't committed any more has already been freed
+	auto state = kmalloc_page_table->get_unit_state(page, AllocationGranularity::Page);
+	if ((page - KMALLOC_SAMPLED_START) % (2 * PAGE_SIZE) != 0 || !state.is_success || state.value != UnitState::Committed){
+		panic(PanicCodes::InvalidParameter);
+	}
+	kmalloc_page_table->decommit(page, 1, AllocationGranularity::Page);
+	
+	if (sample_stats.quarantined == KMALLOC_SAMPLE_QUARANTINE_SIZE){
+		release_oldest_quarantined();
+	}
+	sample_quarantine[(sample_quarantine_start + sample_stats.quarantined) % KMALLOC_SAMPLE_QUARANTINE_SIZE] = (page - KMALLOC_SAMPLED_START) / (2 * PAGE_SIZE);
+	sample_stats.quarantined++;
+	sample_stats.live--;
+}
+
+KmallocSampleStats kmalloc_get_sample_stats(){
+	InterruptGuard guard;
+	auto lock = sample_spinlock_cs.acquire();
+	
+	return sample_stats;
+}
+
+//a sampled object keeps the alignment the size class would have given it: that of its first object, or less if the
+//object size isn't a multiple of it
+static void * slab_alloc(uint32_t size_class, size_t size){
+	if (sample_due()){
+		uint32_t object_size = KMALLOC_SIZE_CLASSES[size_class];
+		size_t alignment = object_size & -object_size;
+		size_t max_alignment = kmalloc_class_alignment(object_size);
 		
-		SmallHeapBlockHeader ** block_ptr = &small_block_heap[alloc_size / SMALL_HEAP_GRANULARITY - 1];
+		void * memory = sampled_alloc(size, (alignment < max_alignment) ? alignment : max_alignment);
+		if (memory != nullptr){
+			return memory;
+		}
+	}
+	
+	return magazine_alloc(size_class);
+}
+
+static void * vmalloc(size_t size){
+	uint32_t num_pages = get_num_allocation_units(size, AllocationGranularity::Page);
+	
+	auto reservation = kmalloc_page_table->reserve_within(VMALLOC_START, VMALLOC_END, num_pages + 1, AllocationGranularity::Page);
+	if (!reservation.is_success){
+		panic(PanicCodes::OutOfMemory);
+	}
+	
+	if (!kmalloc_page_table->allocate(reservation.value, num_pages, AllocationGranularity::Page)){
+		panic(PanicCodes::AssertionFailure);
+	}
+	
+	uint32_t last_page = (reservation.value - VMALLOC_START) / PAGE_SIZE + num_pages - 1;
+	{
+		InterruptGuard guard;
+		vmalloc_last_pages[last_page / 32] |= 0x80000000 >> (last_page % 32);
+	}
+	
+	return (void*)reservation.value;
+}
+
+static void vfree(uintptr_t virtual_address){
+	uint32_t first_page = (virtual_address - VMALLOC_START) / PAGE_SIZE;
+	uint32_t last_page = VMALLOC_PAGES;
+	
+	{
+		InterruptGuard guard;
 		
-		while (true){
-			if (*block_ptr == nullptr){
-				//allocate new block
-				*block_ptr = page_alloc::alloc();
-				(*block_ptr)->next = nullptr;
-				(*block_ptr)->free_entries = small_heap_get_num_entries(alloc_size);
-			}
-			
-			if (free_entries > 0){
-				for (int i = 0; i < small_heap_get_num_entries(alloc_size); i++){
-					if (!(*block_ptr)->utilisation[i]){
-						//we've found a free entry
-						(*block_ptr)->utilisation[i] = true;
-						(*block_ptr)->free_entries--;
-						return (void*)&((*block_ptr)->entries[i]);
-					}
-				}
-				panic(PanicCodes::AssertionFailure);
-			} else {
-				block_ptr = &(*block_ptr)->next;
+		//the first last page at or after the first page is this allocation's
+		for (uint32_t i = first_page; i < VMALLOC_PAGES; i = (i & ~31) + 32){
+			uint32_t word = vmalloc_last_pages[i / 32] & (0xffffffff >> (i % 32));
+			if (word != 0){
+				last_page = (i & ~31) + __builtin_clz(word);
+				vmalloc_last_pages[last_page / 32] &= ~(0x80000000 >> (last_page % 32));
+				break;
 			}
 		}
-	} else if (initial_size <= MEDIUM_HEAP_MAX_SIZE){
-		size_t alloc_size = (initial_size + MEDIUM_HEAP_GRANULARITY - 1) / MEDIUM_HEAP_GRANULARITY * MEDIUM_HEAP_GRANULARITY;
+	}
+	
+	//decommits the pages and releases the range, guard page included
+	if (last_page == VMALLOC_PAGES || !kmalloc_page_table->release(virtual_address, last_page - first_page + 2, AllocationGranularity::Page)){
+		panic(PanicCodes::InvalidParameter);
+	}
+}
+
+//the histogram is per context for the same reason the sample countdown is
+static void * kmalloc_bucket(uint32_t bucket, size_t size){
+	size_histogram[(uint32_t)cpu_get_context()][bucket]++;
+	
+	return slab_alloc(size_class_lookup.size_classes[bucket], size);
+}
+
+void * kmalloc(size_t size){
+	if (size == 0){
+		size = 1;
+	}
+	
+	if (size <= KMALLOC_MAX_SIZE){
+		return kmalloc_bucket((size - 1) / KMALLOC_GRANULE, size);
 	} else {
-		return initial_size;
+		return vmalloc(size);
+	}
+}
+
+//an object is aligned if its size is a multiple of the alignment and the alignment is no more than that of its slab's
+//first object, since colors move that by whole multiples of it; the last class always qualifies
+void * kmalloc_aligned(size_t size, size_t alignment){
+	if (alignment == 0 || (alignment & (alignment - 1)) || alignment > PAGE_SIZE){
+		panic(PanicCodes::InvalidParameter);
+	}
+	
+	if (size == 0){
+		size = 1;
+	}
+	size = (size + alignment - 1) & ~(alignment - 1);
+	
+	if (size > KMALLOC_MAX_SIZE || alignment > KMALLOC_MEDIUM_ALIGNMENT){
+		return vmalloc(size);
 	}
+	
+	uint32_t bucket = (size - 1) / KMALLOC_GRANULE;
+	for (uint32_t size_class = size_class_lookup.size_classes[bucket]; size_class < KMALLOC_NUM_SIZE_CLASSES; size_class++){
+		uint32_t object_size = KMALLOC_SIZE_CLASSES[size_class];
+		
+		if (object_size % alignment == 0 && kmalloc_class_alignment(object_size) >= alignment){
+			//asking for the class's own size makes sure a sampled allocation is aligned as well
+			return kmalloc_bucket((object_size - 1) / KMALLOC_GRANULE, object_size);
+		}
+	}
+	
+	panic(PanicCodes::AssertionFailure);
 }
 
 void kfree(void * memory){
-	//free has no observable semantics, so this is a valid implementation
+	if (memory == nullptr){
+		return;
+	}
+	
+	uintptr_t page = (uintptr_t)memory & ~(PAGE_SIZE - 1);
+	
+	if (page >= KMALLOC_SAMPLED_START && page < KMALLOC_SAMPLED_END){
+		sampled_free(page);
+		return;
+	}
+	
+	if (page >= VMALLOC_START && page < VMALLOC_END){
+		if (page != (uintptr_t)memory){
+			panic(PanicCodes::InvalidParameter);
+		}
+		vfree(page);
+		return;
+	}
+	
+	SlabHeader * slab = slab_find(memory);
+	if (slab == nullptr){
+		panic(PanicCodes::InvalidParameter);
+	}
+	
+	if (slab->cache < caches || slab->cache >= caches + KMALLOC_NUM_SIZE_CLASSES){
+		//an ObjectCache's
+		panic(PanicCodes::InvalidParameter);
+	}
+	
+	magazine_free(slab->cache - caches, memory);
+}
+
+void kmalloc_shrink(){
+	for (uint32_t size_class = 0; size_class < KMALLOC_NUM_SIZE_CLASSES; size_class++){
+		SlabCache &cache = caches[size_class];
+		
+		for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+			InterruptGuard guard;
+			KmallocMagazine &magazine = magazines[i][size_class];
+			
+			slab_cache_free_batch(cache, magazine.objects, magazine.count);
+			magazine.count = 0;
+		}
+		
+		slab_cache_shrink(cache);
+	}
+	
+	slab_sections_shrink();
 }
 
-/*
-#include <iostream>
+KmallocClassStats kmalloc_get_class_stats(uint32_t size_class){
+	if (size_class >= KMALLOC_NUM_SIZE_CLASSES){
+		panic(PanicCodes::InvalidParameter);
+	}
+	
+	SlabCache &cache = caches[size_class];
+	KmallocClassStats retval;
+	
+	InterruptGuard guard;
+	
+	retval.cached = 0;
+	retval.magazine_hits = 0;
+	retval.magazine_misses = 0;
+	for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+		KmallocMagazine &magazine = magazines[i][size_class];
+		retval.cached += magazine.count;
+		retval.magazine_hits += magazine.alloc_hits + magazine.free_hits;
+		retval.magazine_misses += magazine.alloc_misses + magazine.free_misses;
+	}
+	
+	auto lock = cache.spinlock_cs.acquire();
+	
+	retval.object_size = cache.object_size;
+	retval.max_request_waste = cache.object_size - (size_class > 0 ? KMALLOC_SIZE_CLASSES[size_class - 1] : 0) - 1;
+	retval.slab_pages = cache.slab_pages;
+	retval.objects_per_slab = cache.objects_per_slab;
+	retval.slab_waste = cache.slab_pages * PAGE_SIZE - cache.objects_per_slab * cache.object_size;
+	retval.colors = cache.max_color / cache.color_step + 1;
+	retval.slabs = cache.partial.count + cache.full.count + cache.empty.count;
+	retval.objects_in_use = cache.objects_in_use - retval.cached;
+	
+	return retval;
+}
 
-using namespace std;
+void kmalloc_get_size_histogram(uint32_t * counts){
+	InterruptGuard guard;
+	
+	for (uint32_t bucket = 0; bucket < KMALLOC_HISTOGRAM_BUCKETS; bucket++){
+		counts[bucket] = 0;
+		for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+			counts[bucket] += size_histogram[i][bucket];
+		}
+	}
+}
 
-int main(){
-	for (size_t x = SMALL_HEAP_MAX_SIZE + MEDIUM_HEAP_GRANULARITY; x <= MEDIUM_HEAP_MAX_SIZE; x += MEDIUM_HEAP_GRANULARITY){
-		cout << x << " " << medium_heap_get_num_entries(x) << endl;
+void kmalloc_reset_size_histogram(){
+	InterruptGuard guard;
+	
+	for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+		for (uint32_t bucket = 0; bucket < KMALLOC_HISTOGRAM_BUCKETS; bucket++){
+			size_histogram[i][bucket] = 0;
+		}
 	}
-	return 0;
 }
-*/
 
+void kmalloc_print_size_histogram(){
+	for (uint32_t bucket = 0; bucket < KMALLOC_HISTOGRAM_BUCKETS; bucket++){
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+			count += size_histogram[i][bucket];
+		}
+		
+		if (count != 0){
+			uart_puts("kmalloc histogram ");
+			uart_putdec((bucket + 1) * KMALLOC_GRANULE);
+			uart_puts(" ");
+			uart_putdec(count);
+			uart_puts("\r\n");
+		}
+	}
+}
@@ -1,3 +1,104 @@
 #pragma once
 
 #include "common.h"
+#include "page_alloc.h"
+#include "slab.h"
+#include "kmalloc_size_classes.h"
+
+class PageTable;
+
+//objects up to KMALLOC_MAX_SIZE come from slabs, in the size classes listed in kmalloc_size_classes.h; larger ones
+//are mapped page by page into kernel_table, above 0xc0000000
+//classes up to 128 bytes have single-page slabs with their first object on a cache line, and bigger ones multi-page
+//slabs of at least 4 pages with their first object on a 64-byte boundary
+//each CPU context caches free objects of every class, so frees and allocations in the same context mostly don't
+//take a slab lock
+//kmalloc and kfree can be called from any context, interrupt handlers included: the slab, page allocator and page
+//table locks are all only held with interrupts masked, so none of them can be taken by whatever a holder interrupted
+const size_t KMALLOC_GRANULE = 4;
+const size_t KMALLOC_SMALL_MAX_SIZE = 128;
+const size_t KMALLOC_MAX_SIZE = 2048;
+
+const uint32_t KMALLOC_SMALL_MIN_SLAB_PAGES = 1;
+const uint32_t KMALLOC_MEDIUM_MIN_SLAB_PAGES = 4;
+const uint32_t KMALLOC_MEDIUM_ALIGNMENT = 64;
+
+constexpr uint32_t kmalloc_class_alignment(size_t object_size){
+	return (object_size <= KMALLOC_SMALL_MAX_SIZE) ? CACHE_LINE_SIZE : KMALLOC_MEDIUM_ALIGNMENT;
+}
+
+constexpr uint32_t kmalloc_class_slab_pages(size_t object_size){
+	return (object_size <= KMALLOC_SMALL_MAX_SIZE) ? KMALLOC_SMALL_MIN_SLAB_PAGES :
+		slab_get_num_pages(object_size, KMALLOC_MEDIUM_ALIGNMENT, KMALLOC_MEDIUM_MIN_SLAB_PAGES);
+}
+
+const uint32_t KMALLOC_NUM_SIZE_CLASSES = sizeof(KMALLOC_SIZE_CLASSES) / sizeof(KMALLOC_SIZE_CLASSES[0]);
+
+//requests are counted in buckets of KMALLOC_GRANULE bytes: bucket i is requests of i * 4 + 1 to i * 4 + 4 bytes
+const uint32_t KMALLOC_HISTOGRAM_BUCKETS = KMALLOC_MAX_SIZE / KMALLOC_GRANULE;
+
+//internal fragmentation of one size class: a request can lose up to max_request_waste bytes to rounding up to
+//object_size, and each slab loses slab_waste bytes to its header and the space left over after its last object
+struct KmallocClassStats {
+	uint32_t object_size;
+	uint32_t max_request_waste;
+	uint32_t slab_pages;
+	uint32_t objects_per_slab;
+	uint32_t slab_waste;
+	uint32_t colors; //different offsets the slabs start their objects at
+	
+	uint32_t slabs;
+	uint32_t objects_in_use; //handed out and not yet freed; the rest of slabs * objects_per_slab are free
+	uint32_t cached; //free objects held in the CPU contexts' magazines, which the slabs count as in use
+	
+	uint32_t magazine_hits; //allocations and frees that didn't have to go to the slabs
+	uint32_t magazine_misses; //magazine refills and flushes, each of which goes to the slabs once
+};
+
+//one in about every sample_rate slab allocations is sampled: it is given a page of its own instead, placed so that
+//it ends where the page does, in front of a guard page that is reserved but never committed; freeing it decommits
+//the page and holds on to its address for a while, so overflows and uses after free fault instead of going unnoticed
+//each sampled allocation takes a slot of two pages between these addresses, which is how the data abort handler
+//tells the faults apart; while every slot is taken, allocations aren't sampled
+//the slots are all reserved by kmalloc_init, so sampling and freeing a sampled allocation only commit and decommit
+//its page
+const uintptr_t KMALLOC_SAMPLED_START = 0xf0000000;
+const uint32_t KMALLOC_SAMPLED_SLOTS = 1024;
+const uintptr_t KMALLOC_SAMPLED_END = KMALLOC_SAMPLED_START + KMALLOC_SAMPLED_SLOTS * 2 * PAGE_SIZE;
+const uint32_t KMALLOC_DEFAULT_SAMPLE_RATE = 4096;
+
+//freed sampled pages stay decommitted until this many more have been freed, and only then is their slot reused
+const uint32_t KMALLOC_SAMPLE_QUARANTINE_SIZE = 256;
+
+void kmalloc_init(PageAlloc &page_alloc, PageTable &kernel_table);
+
+void * kmalloc(size_t size);
+void * kmalloc_aligned(size_t size, size_t alignment); //alignment is a power of two up to PAGE_SIZE
+void kfree(void * memory);
+
+//returns the objects cached in every CPU context's magazines to their slabs, and the slabs (and sections) left empty
+//to PageAlloc
+void kmalloc_shrink();
+
+//0 turns sampling off; allocations already sampled stay guarded until they are freed
+void kmalloc_set_sample_rate(uint32_t sample_rate);
+
+struct KmallocSampleStats {
+	uint32_t sampled; //allocations that were given a guarded page
+	uint32_t live;
+	uint32_t quarantined; //freed, and their slots not yet reused
+	uint32_t failed; //sampled allocations that fell back to a slab because every slot was taken
+};
+
+KmallocSampleStats kmalloc_get_sample_stats();
+
+//counts of slab-sized requests since boot (or the last reset), summed over every CPU context, into
+//KMALLOC_HISTOGRAM_BUCKETS entries
+void kmalloc_get_size_histogram(uint32_t * counts);
+void kmalloc_reset_size_histogram();
+//a "kmalloc histogram <size> <count>" line for each bucket in use, by the largest size in it, which is what
+//host/size_class_tuner reads
+void kmalloc_print_size_histogram();
+
+//size classes are numbered from 0 in increasing size
+KmallocClassStats kmalloc_get_class_stats(uint32_t size_class);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "common.h"
+
+//the object sizes of kmalloc's size classes, smallest first: multiples of KMALLOC_GRANULE, ending at KMALLOC_MAX_SIZE
+//host/size_class_tuner writes a replacement for this file, fitted to a size histogram from kmalloc_print_size_histogram;
+//this one is the untuned table, 4-byte steps up to 128 bytes and 64-byte steps after that
+constexpr uint32_t KMALLOC_SIZE_CLASSES[] = {
+	4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 60, 64,
+	68, 72, 76, 80, 84, 88, 92, 96, 100, 104, 108, 112, 116, 120, 124, 128,
+	192, 256, 320, 384, 448, 512, 576, 640, 704, 768, 832, 896, 960, 1024, 1088, 1152,
+	1216, 1280, 1344, 1408, 1472, 1536, 1600, 1664, 1728, 1792, 1856, 1920, 1984, 2048,
+};
@@ -0,0 +1,306 @@
+#include "runtime_tests.h"
+#include "kmalloc.h"
+#include "pagetable.h"
+#include "slab.h"
+#include "uart.h"
+#include "utility.h"
+#include "page_alloc.h"
+
+//whether memory holds count bytes of value
+static bool holds(void * memory, uint8_t value, size_t count){
+	uint8_t * bytes = (uint8_t*)memory;
+	for (size_t i = 0; i < count; i++){
+		if (bytes[i] != value){
+			return false;
+		}
+	}
+	return true;
+}
+
+bool test_kmalloc(PageAlloc &page_alloc) {
+	bool all_passed = true;
+	
+	MemStats stats_i = page_alloc.get_mem_stats();
+	
+	{
+		PageTable kernel_table(page_alloc, true);
+		kmalloc_init(page_alloc, kernel_table);
+		
+		//so that every allocation comes from its slab
+		kmalloc_set_sample_rate(0);
+		
+		uart_puts("kmalloc round trips every size class: ");
+		{
+			const uint32_t per_class = 3;
+			
+			for (uint32_t size_class = 0; size_class < KMALLOC_NUM_SIZE_CLASSES; size_class++){
+				uint32_t object_size = KMALLOC_SIZE_CLASSES[size_class];
+				uint32_t smallest = (size_class > 0) ? KMALLOC_SIZE_CLASSES[size_class - 1] + 1 : 1;
+				
+				//the smallest and the largest request the class serves, each filled with its own value
+				void * objects[2 * per_class];
+				for (uint32_t i = 0; i < 2 * per_class; i++){
+					size_t size = (i < per_class) ? smallest : object_size;
+					objects[i] = kmalloc(size);
+					
+					SlabHeader * slab = slab_find(objects[i]);
+					all_passed &= slab != nullptr && slab->cache->object_size == object_size;
+					memset((uintptr_t)objects[i], (uint8_t)(size_class + i), size);
+				}
+				
+				for (uint32_t i = 0; i < 2 * per_class; i++){
+					size_t size = (i < per_class) ? smallest : object_size;
+					all_passed &= holds(objects[i], (uint8_t)(size_class + i), size);
+					kfree(objects[i]);
+				}
+				
+				KmallocClassStats stats = kmalloc_get_class_stats(size_class);
+				all_passed &= stats.objects_in_use == 0;
+			}
+			
+			//a zero-byte request still gets an object of its own
+			void * a = kmalloc(0);
+			void * b = kmalloc(0);
+			all_passed &= a != nullptr && b != nullptr && a != b;
+			kfree(a);
+			kfree(b);
+			kfree(nullptr);
+			
+			//shrinking gives back everything the heap took
+			kmalloc_shrink();
+			for (uint32_t size_class = 0; size_class < KMALLOC_NUM_SIZE_CLASSES; size_class++){
+				KmallocClassStats stats = kmalloc_get_class_stats(size_class);
+				all_passed &= stats.slabs == 0 && stats.cached == 0;
+			}
+			all_passed &= slab_get_num_sections() == 0;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("kmalloc_aligned aligns every size: ");
+		{
+			const size_t sizes[] = {1, 24, 100, 500, 1500, KMALLOC_MAX_SIZE};
+			
+			for (size_t size : sizes){
+				for (size_t alignment = KMALLOC_GRANULE; alignment <= KMALLOC_MEDIUM_ALIGNMENT; alignment *= 2){
+					void * memory = kmalloc_aligned(size, alignment);
+					all_passed &= (uintptr_t)memory % alignment == 0;
+					
+					SlabHeader * slab = slab_find(memory);
+					all_passed &= slab != nullptr && slab->cache->object_size >= size;
+					
+					memset((uintptr_t)memory, 0xa5, size);
+					all_passed &= holds(memory, 0xa5, size);
+					kfree(memory);
+				}
+			}
+			
+			//more than a slab can align to goes to its own pages
+			for (size_t alignment = 2 * KMALLOC_MEDIUM_ALIGNMENT; alignment <= PAGE_SIZE; alignment *= 2){
+				void * memory = kmalloc_aligned(24, alignment);
+				all_passed &= (uintptr_t)memory % PAGE_SIZE == 0 && slab_find(memory) == nullptr;
+				kfree(memory);
+			}
+			
+			kmalloc_shrink();
+			all_passed &= slab_get_num_sections() == 0;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Magazines refill and flush half of themselves at a time: ");
+		{
+			//a small class's magazine holds 16 objects and a medium one's 4
+			const uint32_t classes[] = {0, KMALLOC_NUM_SIZE_CLASSES - 1};
+			const uint32_t magazine_sizes[] = {16, 4};
+			
+			for (uint32_t c = 0; c < 2; c++){
+				uint32_t size = KMALLOC_SIZE_CLASSES[classes[c]];
+				uint32_t half = magazine_sizes[c] / 2;
+				KmallocClassStats stats_start = kmalloc_get_class_stats(classes[c]);
+				all_passed &= stats_start.cached == 0;
+				
+				//a refill on the first allocation and after every half more; the last leaves the magazine one short of half
+				uint32_t allocs = 2 * half + 1;
+				void * objects[2 * 16 + 1];
+				for (uint32_t i = 0; i < allocs; i++){
+					objects[i] = kmalloc(size);
+				}
+				
+				KmallocClassStats stats = kmalloc_get_class_stats(classes[c]);
+				all_passed &= stats.magazine_misses - stats_start.magazine_misses == 3;
+				all_passed &= stats.magazine_hits - stats_start.magazine_hits == allocs - 3;
+				all_passed &= stats.cached == half - 1 && stats.objects_in_use == allocs;
+				
+				//the last freed is the first handed out again
+				kfree(objects[0]);
+				all_passed &= kmalloc(size) == objects[0];
+				
+				//frees fill the magazine, and the one that finds it full flushes half of it to the slab first
+				for (uint32_t i = 0; i < allocs; i++){
+					kfree(objects[i]);
+				}
+				
+				KmallocClassStats stats_freed = kmalloc_get_class_stats(classes[c]);
+				all_passed &= stats_freed.magazine_misses - stats.magazine_misses == 1;
+				all_passed &= stats_freed.magazine_hits - stats.magazine_hits == 2 + allocs - 1;
+				all_passed &= stats_freed.cached == magazine_sizes[c] && stats_freed.objects_in_use == 0;
+			}
+			
+			kmalloc_shrink();
+			all_passed &= kmalloc_get_class_stats(0).cached == 0 && kmalloc_get_class_stats(KMALLOC_NUM_SIZE_CLASSES - 1).cached == 0;
+			all_passed &= slab_get_num_sections() == 0;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Sampled allocations end at a guard page: ");
+		{
+			//every slab allocation is sampled; its page isn't mapped on the host, so it is only looked at through the table
+			kmalloc_set_sample_rate(1);
+			KmallocSampleStats stats_start = kmalloc_get_sample_stats();
+			
+			const size_t sizes[] = {1, 100, 1000, KMALLOC_MAX_SIZE};
+			for (size_t size : sizes){
+				void * memory = kmalloc(size);
+				uintptr_t page = (uintptr_t)memory & ~(PAGE_SIZE - 1);
+				all_passed &= page >= KMALLOC_SAMPLED_START && page < KMALLOC_SAMPLED_END && slab_find(memory) == nullptr;
+				
+				//as close to the end of the page as the size class's alignment lets it
+				all_passed &= (uintptr_t)memory + size <= page + PAGE_SIZE && (uintptr_t)memory + size + 32 > page + PAGE_SIZE;
+				
+				auto state = kernel_table.get_unit_state(page, AllocationGranularity::Page);
+				all_passed &= state.is_success && state.value == UnitState::Committed;
+				state = kernel_table.get_unit_state(page + PAGE_SIZE, AllocationGranularity::Page);
+				all_passed &= state.is_success && state.value == UnitState::Reserved;
+				
+				kfree(memory);
+				
+				//a use after free faults as well
+				state = kernel_table.get_unit_state(page, AllocationGranularity::Page);
+				all_passed &= state.is_success && state.value == UnitState::Reserved;
+			}
+			
+			void * aligned = kmalloc_aligned(24, 16);
+			all_passed &= (uintptr_t)aligned >= KMALLOC_SAMPLED_START && (uintptr_t)aligned % 16 == 0;
+			kfree(aligned);
+			
+			KmallocSampleStats stats = kmalloc_get_sample_stats();
+			all_passed &= stats.sampled - stats_start.sampled == 5 && stats.live == 0;
+			all_passed &= stats.quarantined - stats_start.quarantined == 5;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Freed sampled slots are quarantined before reuse: ");
+		{
+			MemStats stats_before = page_alloc.get_mem_stats();
+			
+			//a freed slot is handed out again only once as many more have been freed as the quarantine holds
+			void * first = kmalloc(8);
+			uintptr_t first_page = (uintptr_t)first & ~(PAGE_SIZE - 1);
+			kfree(first);
+			
+			uint32_t reused_after = KMALLOC_SAMPLED_SLOTS;
+			for (uint32_t i = 0; i < KMALLOC_SAMPLED_SLOTS; i++){
+				void * memory = kmalloc(8);
+				if (((uintptr_t)memory & ~(PAGE_SIZE - 1)) == first_page && reused_after == KMALLOC_SAMPLED_SLOTS){
+					reused_after = i;
+				}
+				kfree(memory);
+			}
+			all_passed &= reused_after == KMALLOC_SAMPLE_QUARANTINE_SIZE;
+			
+			KmallocSampleStats stats = kmalloc_get_sample_stats();
+			all_passed &= stats.quarantined == KMALLOC_SAMPLE_QUARANTINE_SIZE && stats.live == 0;
+			
+			//once every slot is live, allocations fall back to the slabs
+			void * objects[KMALLOC_SAMPLED_SLOTS + 1];
+			for (uint32_t i = 0; i <= KMALLOC_SAMPLED_SLOTS; i++){
+				objects[i] = kmalloc(8);
+			}
+			stats = kmalloc_get_sample_stats();
+			all_passed &= stats.live == KMALLOC_SAMPLED_SLOTS && stats.quarantined == 0 && stats.failed == 1;
+			all_passed &= slab_find(objects[KMALLOC_SAMPLED_SLOTS]) != nullptr;
+			
+			for (uint32_t i = 0; i <= KMALLOC_SAMPLED_SLOTS; i++){
+				kfree(objects[i]);
+			}
+			kmalloc_set_sample_rate(0);
+			kmalloc_shrink();
+			
+			//the quarantine holds addresses, not memory
+			all_passed &= page_alloc.get_mem_stats().usedmem == stats_before.usedmem;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Large allocations are mapped with a guard page: ");
+		{
+			//so that the second-level table they land in is already there, and stays
+			void * first = kmalloc(KMALLOC_MAX_SIZE + 1);
+			MemStats stats_before = page_alloc.get_mem_stats();
+			
+			void * a = kmalloc(3 * PAGE_SIZE);
+			void * b = kmalloc(KMALLOC_MAX_SIZE + 1);
+			void * c = kmalloc_aligned(64, 256);
+			all_passed &= (uintptr_t)a % PAGE_SIZE == 0 && (uintptr_t)b % PAGE_SIZE == 0 && (uintptr_t)c % PAGE_SIZE == 0;
+			all_passed &= page_alloc.get_mem_stats().usedmem - stats_before.usedmem == 5 * PAGE_SIZE;
+			
+			uintptr_t pages[] = {(uintptr_t)a, (uintptr_t)a + 2 * PAGE_SIZE, (uintptr_t)b, (uintptr_t)c};
+			for (uintptr_t page : pages){
+				auto state = kernel_table.get_unit_state(page, AllocationGranularity::Page);
+				all_passed &= state.is_success && state.value == UnitState::Committed;
+			}
+			
+			auto guard_state = kernel_table.get_unit_state((uintptr_t)a + 3 * PAGE_SIZE, AllocationGranularity::Page);
+			all_passed &= guard_state.is_success && guard_state.value == UnitState::Reserved;
+			
+			//each frees exactly its own pages, whatever order they go in
+			kfree(b);
+			all_passed &= page_alloc.get_mem_stats().usedmem - stats_before.usedmem == 4 * PAGE_SIZE;
+			kfree(a);
+			all_passed &= page_alloc.get_mem_stats().usedmem - stats_before.usedmem == PAGE_SIZE;
+			kfree(c);
+			all_passed &= page_alloc.get_mem_stats().usedmem == stats_before.usedmem;
+			
+			guard_state = kernel_table.get_unit_state((uintptr_t)a + 3 * PAGE_SIZE, AllocationGranularity::Page);
+			all_passed &= guard_state.is_success && guard_state.value == UnitState::Free;
+			
+			kfree(first);
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_putline();
+	}
+	
+	MemStats stats_f = page_alloc.get_mem_stats();
+	
+	if (stats_i.usedmem != stats_f.usedmem){
+		uart_puts("Leaked ");
+		uart_puthex(stats_f.usedmem - stats_i.usedmem);
+		uart_puts(" bytes\r\n");
+		all_passed = false;
+	}
+	
+	return all_passed;
+}
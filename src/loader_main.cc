@@ -7,14 +7,15 @@
 #include "panic.h"
 #include "elf_loader.h"
 #include "pagetable.h"
+#include "kmalloc.h"
 #include "runtime_tests.h"
 
 //#define RUN_TESTS
 
 extern uint32_t _binary_kernel_stripped_elf_start;
-extern refcount_t __page_alloc_table_start;
+extern PageFrame __page_alloc_table_start;
 
-typedef void KernelEntryProc(PageTable*, PageTable*);
+typedef void KernelEntryProc(PageTable*, PageTable*, PageAlloc*);
   
 extern "C"
 void loader_main(uint32_t r0, uint32_t r1, void * atags, uint32_t cpsr_saved)
@@ -88,8 +89,20 @@ void loader_main(uint32_t r0, uint32_t r1, void * atags, uint32_t cpsr_saved)
 		[undef_stack] "r" (undef_stack)
 		);
 	
+	//zero a batch of pages up front for the page tables built below
+	page_alloc.refill_zeroed_pool(ZEROED_POOL_TARGET);
+	
 #ifdef RUN_TESTS
-	if (test_pagetables(page_alloc)){
+	bool all_passed = true;
+	
+	//non-short circuit
+	all_passed &= test_page_alloc(page_alloc);
+	all_passed &= test_pagetables(page_alloc);
+	all_passed &= test_slab(page_alloc);
+	all_passed &= test_kmalloc(page_alloc);
+	all_passed &= test_object_cache(page_alloc);
+	
+	if (all_passed){
 		uart_puts("All tests passed\r\n");
 	} else {
 		uart_puts("Some tests failed\r\n");
@@ -159,7 +172,7 @@ void loader_main(uint32_t r0, uint32_t r1, void * atags, uint32_t cpsr_saved)
 	
 	//panic(PanicCodes::AssertionFailure);
 	
-	entry_proc(&identity_overlay, &supervisor_table);
+	entry_proc(&identity_overlay, &supervisor_table, &page_alloc);
 	
 	panic(PanicCodes::AssertionFailure);
 #endif
@@ -193,9 +206,25 @@ void prefetch_abort_handler(uint32_t saved_pc){
 
 extern "C"
 void data_abort_handler(uint32_t saved_pc){
+	uint32_t fault_status;
+	uintptr_t fault_address;
+	asm volatile(
+		"mrc p15, 0, %[dfsr], c5, c0, 0\n"
+		"mrc p15, 0, %[dfar], c6, c0, 0"
+		: [dfsr] "=r" (fault_status), [dfar] "=r" (fault_address));
+	
 	uart_puts("Data abort at ");
 	uart_puthex(saved_pc);
+	uart_puts(" accessing ");
+	uart_puthex(fault_address);
+	uart_puts(", status ");
+	uart_puthex(fault_status);
 	uart_puts("\r\n");
+	
+	//a guard page or a freed page of an allocation kmalloc sampled; returning would only retry the access
+	if (fault_address >= KMALLOC_SAMPLED_START && fault_address < KMALLOC_SAMPLED_END){
+		panic(PanicCodes::SampledHeapFault);
+	}
 }
 
 extern "C"
@@ -11,21 +11,31 @@ arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c mmio.cc -o build/mmio.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c uart.cc -o build/uart.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c atags.cc -o build/atags.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c utility.cc -o build/utility.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c bitmap.cc -o build/bitmap.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c page_alloc.cc -o build/page_alloc.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c panic.cc -o build/panic.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c elf_loader.cc -o build/elf_loader.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c kernel_entry.cc -o build/kernel_entry.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c kmalloc.cc -o build/kmalloc.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c slab.cc -o build/slab.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c slab_benchmarks.cc -o build/slab_benchmarks.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c pagetable_benchmarks.cc -o build/pagetable_benchmarks.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c spinlock.cc -o build/spinlock.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c pagetable.cc -o build/pagetable.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c reverse_map.cc -o build/reverse_map.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c page_alloc_tests.cc -o build/page_alloc_tests.o
 arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c pagetable_tests.cc -o build/pagetable_tests.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c slab_tests.cc -o build/slab_tests.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c kmalloc_tests.cc -o build/kmalloc_tests.o
+arm-none-eabi-g++ $ASMFLAGS $CXXFLAGS -c object_cache_tests.cc -o build/object_cache_tests.o
 
-arm-none-eabi-g++ -g -T phlogiston_link.ld -o kernel.elf -flto -fpic -ffreestanding -O2 build/utility.o build/mmio.o build/uart.o build/panic.o build/pagetable.o build/spinlock.o build/page_alloc.o build/kernel_entry.o -nostdlib -lgcc
+arm-none-eabi-g++ -g -T phlogiston_link.ld -o kernel.elf -flto -fpic -ffreestanding -O2 build/utility.o build/mmio.o build/uart.o build/panic.o build/pagetable.o build/reverse_map.o build/spinlock.o build/bitmap.o build/page_alloc.o build/slab.o build/kmalloc.o build/slab_benchmarks.o build/pagetable_benchmarks.o build/kernel_entry.o -nostdlib -lgcc
 
 arm-none-eabi-objcopy --only-keep-debug kernel.elf kernel.sym
 arm-none-eabi-objcopy -S kernel.elf kernel-stripped.elf
 arm-none-eabi-objcopy -I binary -O elf32-littlearm -B arm kernel-stripped.elf kernel-binary.o
 
-arm-none-eabi-g++ -g -T loader_link.ld -o loader.elf -flto -fpic -ffreestanding -O2 build/boot.o build/interrupts.o build/utility.o build/mmio.o build/uart.o build/atags.o build/page_alloc.o build/panic.o build/elf_loader.o build/loader_main.o build/spinlock.o build/pagetable.o build/pagetable_tests.o kernel-binary.o -nostdlib -lgcc
+arm-none-eabi-g++ -g -T loader_link.ld -o loader.elf -flto -fpic -ffreestanding -O2 build/boot.o build/interrupts.o build/utility.o build/mmio.o build/uart.o build/atags.o build/bitmap.o build/page_alloc.o build/panic.o build/elf_loader.o build/loader_main.o build/spinlock.o build/pagetable.o build/reverse_map.o build/page_alloc_tests.o build/pagetable_tests.o build/slab.o build/kmalloc.o build/slab_tests.o build/kmalloc_tests.o build/object_cache_tests.o kernel-binary.o -nostdlib -lgcc
 
 arm-none-eabi-objcopy loader.elf -O binary phlogiston.bin
 
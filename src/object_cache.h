@@ -0,0 +1,159 @@
+#pragma once
+
+#include "common.h"
+#include "cpu.h"
+#include "panic.h"
+#include "slab.h"
+#include "spinlock.h"
+
+#include <new>
+#include <utility>
+
+struct ObjectCacheStats {
+	uint32_t hits; //allocations handed an object that was already constructed
+	uint32_t misses; //allocations that had to construct one
+	uint32_t in_use;
+	uint32_t cached; //constructed and waiting to be handed out again
+	uint32_t slabs;
+};
+
+//a cache of constructed objects of one type, for kernel objects that are created and destroyed often
+//objects get slabs of their own, so alloc skips kmalloc's size-class lookup; each object starts on a cache line, and
+//a colored cache also staggers where the objects start from slab to slab
+//up to MaxCached freed objects are kept constructed and handed out again as they are, so the caller has to leave an
+//object fit for reuse when it frees it; only objects that don't fit are destroyed and returned to their slab
+//alloc passes its arguments to T's constructor; an object that is kept is only handed out as it is by an alloc
+//without any, and is otherwise constructed again in place with them, which still skips the slab allocation
+//slab_init (done by kmalloc_init) must have been called before the first alloc
+template<class T, uint32_t MaxCached = 32>
+class ObjectCache {
+private:
+	static constexpr uint32_t OBJECT_SIZE = (sizeof(T) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+	
+	static_assert(alignof(T) <= CACHE_LINE_SIZE, "objects are only aligned to cache lines");
+	
+	SlabCache slab_cache;
+	
+	Spinlock spinlock_cs; //for the fields below
+	T * constructed[MaxCached];
+	uint32_t num_constructed;
+	uint32_t hits;
+	uint32_t misses;
+
+public:
+	ObjectCache(bool colored = true);
+	ObjectCache(const ObjectCache &other) = delete;
+	~ObjectCache(); //every object must have been freed
+	
+	template<class... Args>
+	T * alloc(Args&&... args);
+	void free(T * object);
+	
+	void shrink(); //destroys the constructed objects being kept and returns empty slabs to PageAlloc
+	
+	ObjectCacheStats get_stats();
+};
+
+template<class T, uint32_t MaxCached>
+ObjectCache<T, MaxCached>::ObjectCache(bool colored) :
+	num_constructed(0), hits(0), misses(0)
+{
+	slab_cache_init(slab_cache, OBJECT_SIZE, slab_get_num_pages(OBJECT_SIZE, CACHE_LINE_SIZE, 1), CACHE_LINE_SIZE, colored);
+}
+
+template<class T, uint32_t MaxCached>
+ObjectCache<T, MaxCached>::~ObjectCache(){
+	shrink();
+	
+	if (slab_cache.objects_in_use != 0){
+		panic(PanicCodes::AssertionFailure);
+	}
+}
+
+template<class T, uint32_t MaxCached>
+template<class... Args>
+T * ObjectCache<T, MaxCached>::alloc(Args&&... args){
+	T * object = nullptr;
+	
+	{
+		InterruptGuard guard;
+		auto lock = spinlock_cs.acquire();
+		
+		if (num_constructed > 0){
+			hits++;
+			object = constructed[--num_constructed];
+		} else {
+			misses++;
+		}
+	}
+	
+	if (object == nullptr){
+		return new (slab_cache_alloc(slab_cache)) T(std::forward<Args>(args)...);
+	}
+	
+	if constexpr (sizeof...(Args) > 0){
+		object->~T();
+		new (object) T(std::forward<Args>(args)...);
+	}
+	
+	return object;
+}
+
+template<class T, uint32_t MaxCached>
+void ObjectCache<T, MaxCached>::free(T * object){
+	if (object == nullptr){
+		return;
+	}
+	
+	{
+		InterruptGuard guard;
+		auto lock = spinlock_cs.acquire();
+		
+		if (num_constructed < MaxCached){
+			constructed[num_constructed++] = object;
+			return;
+		}
+	}
+	
+	object->~T();
+	slab_cache_free(slab_find(object), object);
+}
+
+template<class T, uint32_t MaxCached>
+void ObjectCache<T, MaxCached>::shrink(){
+	while (true){
+		T * object;
+		
+		{
+			InterruptGuard guard;
+			auto lock = spinlock_cs.acquire();
+			
+			if (num_constructed == 0){
+				break;
+			}
+			object = constructed[--num_constructed];
+		}
+		
+		object->~T();
+		slab_cache_free(slab_find(object), object);
+	}
+	
+	slab_cache_shrink(slab_cache);
+}
+
+template<class T, uint32_t MaxCached>
+ObjectCacheStats ObjectCache<T, MaxCached>::get_stats(){
+	ObjectCacheStats retval;
+	
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	auto slab_lock = slab_cache.spinlock_cs.acquire();
+	
+	retval.hits = hits;
+	retval.misses = misses;
+	retval.in_use = slab_cache.objects_in_use - num_constructed;
+	retval.cached = num_constructed;
+	retval.slabs = slab_cache.partial.count + slab_cache.full.count + slab_cache.empty.count;
+	
+	return retval;
+}
@@ -0,0 +1,138 @@
+#include "runtime_tests.h"
+#include "object_cache.h"
+#include "pagetable.h"
+#include "slab.h"
+#include "uart.h"
+#include "page_alloc.h"
+
+static uint32_t constructions = 0;
+static uint32_t destructions = 0;
+
+struct CachedTestObject {
+	uint32_t value;
+	uint32_t padding[9]; //so objects span more than one cache line
+	
+	CachedTestObject() : value(0) { constructions++; }
+	CachedTestObject(uint32_t _value) : value(_value) { constructions++; }
+	~CachedTestObject() { destructions++; }
+};
+
+bool test_object_cache(PageAlloc &page_alloc) {
+	bool all_passed = true;
+	
+	//the loader runs its tests before there is a kmalloc to do this
+	slab_init(page_alloc);
+	
+	MemStats stats_i = page_alloc.get_mem_stats();
+	
+	{
+		ObjectCache<CachedTestObject, 2> cache;
+		
+		uart_puts("Object cache keeps freed objects constructed: ");
+		{
+			CachedTestObject * a = cache.alloc();
+			CachedTestObject * b = cache.alloc();
+			CachedTestObject * c = cache.alloc();
+			
+			all_passed &= constructions == 3 && destructions == 0;
+			all_passed &= (uintptr_t)a % CACHE_LINE_SIZE == 0 && (uintptr_t)b % CACHE_LINE_SIZE == 0 && (uintptr_t)c % CACHE_LINE_SIZE == 0;
+			
+			b->value = 42;
+			cache.free(b);
+			CachedTestObject * d = cache.alloc();
+			
+			//handed back as it was, without being constructed again
+			all_passed &= d == b && d->value == 42;
+			all_passed &= constructions == 3 && destructions == 0;
+			
+			ObjectCacheStats stats = cache.get_stats();
+			all_passed &= stats.hits == 1 && stats.misses == 3 && stats.in_use == 3 && stats.cached == 0;
+			
+			cache.free(a);
+			cache.free(c);
+			cache.free(d);
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Object cache destroys what it can't keep: ");
+		{
+			//one of the three freed above didn't fit
+			ObjectCacheStats stats = cache.get_stats();
+			all_passed &= destructions == 1;
+			all_passed &= stats.in_use == 0 && stats.cached == 2 && stats.slabs == 1;
+			
+			cache.shrink();
+			stats = cache.get_stats();
+			all_passed &= destructions == 3;
+			all_passed &= stats.in_use == 0 && stats.cached == 0 && stats.slabs == 0;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Object cache passes constructor arguments: ");
+		{
+			CachedTestObject * a = cache.alloc(7u);
+			all_passed &= a->value == 7 && constructions == 4;
+			
+			a->value = 8;
+			cache.free(a);
+			
+			//a kept object is constructed again with the new arguments
+			CachedTestObject * b = cache.alloc(9u);
+			all_passed &= b == a && b->value == 9;
+			all_passed &= constructions == 5 && destructions == 4;
+			
+			cache.free(b);
+			cache.shrink();
+			all_passed &= destructions == 5;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Object cache holds page tables: ");
+		{
+			ObjectCache<PageTable, 1> tables;
+			
+			PageTable * a = tables.alloc(page_alloc, false);
+			all_passed &= a->reserve(0x10000000, 1, AllocationGranularity::Section).is_success;
+			tables.free(a);
+			
+			//the same memory, but a new table, so the reservation is gone
+			PageTable * b = tables.alloc(page_alloc, false);
+			all_passed &= b == a;
+			
+			auto check = b->get_unit_state(0x10000000, AllocationGranularity::Section);
+			all_passed &= check.is_success && check.value == UnitState::Free;
+			
+			tables.free(b);
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_putline();
+	}
+	
+	MemStats stats_f = page_alloc.get_mem_stats();
+	
+	if (stats_i.usedmem != stats_f.usedmem){
+		uart_puts("Leaked ");
+		uart_puthex(stats_f.usedmem - stats_i.usedmem);
+		uart_puts(" bytes\r\n");
+		all_passed = false;
+	}
+	
+	return all_passed;
+}
@@ -1,29 +1,81 @@
 #include "page_alloc.h"
+#include "pagetable.h"
 
 #include "utility.h"
 #include "panic.h"
 #include "uart.h"
 
-PageAlloc::PageAlloc(uint32_t total_memory, refcount_t * table_location){
+#include <algorithm>
+
+PageAlloc::PageAlloc(uint32_t total_memory, PageFrame * table_location){
 	uart_puts("Initialising page allocator\r\n");
-	refcount_table = table_location;
-	uart_puts("refcount_table = "); uart_puthex((uint32_t)refcount_table); uart_puts("\r\n");
 	
 	num_pages = total_memory / PAGE_SIZE;
 	uart_puts("num_pages = "); uart_puthex(num_pages); uart_puts("\r\n");
+	
+	//frames, pageblock mobilities, then the (word-aligned) free block bitmaps for each order
+	uintptr_t table_base = (uintptr_t)table_location;
+	frames = table_location;
+	uart_puts("frames = "); uart_puthex((uintptr_t)frames); uart_puts("\r\n");
+	
+	uint32_t num_pageblocks = (num_pages + (1 << PAGEBLOCK_ORDER) - 1) >> PAGEBLOCK_ORDER;
+	pageblock_mobility = (PageMobility*)&frames[num_pages];
+	for (uint32_t i = 0; i < num_pageblocks; i++){
+		pageblock_mobility[i] = PageMobility::Unmovable;
+	}
+	
+	uint32_t * bitmap_storage = (uint32_t*)(((uintptr_t)&pageblock_mobility[num_pageblocks] + 3) & ~(uintptr_t)3);
+	for (uint32_t order = 0; order < PAGE_ALLOC_NUM_ORDERS; order++){
+		uint32_t num_blocks = num_pages >> order;
+		
+		if (order < PAGEBLOCK_ORDER){
+			for (uint32_t mobility = 0; mobility < NUM_PAGE_MOBILITIES; mobility++){
+				free_blocks[mobility][order].init(bitmap_storage, num_blocks);
+				bitmap_storage += HierarchicalBitmap::get_storage_words(num_blocks);
+			}
+		} else {
+			free_pageblocks[order - PAGEBLOCK_ORDER].init(bitmap_storage, num_blocks);
+			bitmap_storage += HierarchicalBitmap::get_storage_words(num_blocks);
+		}
+	}
+	uintptr_t table_end = (uintptr_t)bitmap_storage;
 
-	uint32_t pages_used_for_table = (num_pages * sizeof(refcount_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+	uint32_t pages_used_for_table = (table_end - table_base + PAGE_SIZE - 1) / PAGE_SIZE;
 	uart_puts("pages_used_for_table = "); uart_puthex(pages_used_for_table); uart_puts("\r\n");
 	
-	uint32_t first_free_page = ((uintptr_t)table_location) / PAGE_SIZE + pages_used_for_table;
+	uint32_t first_free_page = table_base / PAGE_SIZE + pages_used_for_table;
+	
+	for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+		for (uint32_t mobility = 0; mobility < NUM_PAGE_MOBILITIES; mobility++){
+			magazines[i][mobility] = PageMagazine();
+		}
+	}
+	
+	zeroed_pool_head = NULL_PAGE_INDEX;
+	zeroed_pool_count = 0;
+	
+	movable_tables = nullptr;
+	compaction_cursor = 0;
+	compaction_start = 0;
+	compaction_end = 0;
 
 	for (uint32_t i = 0; i < num_pages; i++){
-		if (i < first_free_page){
-			refcount_table[i] = 1;
-			allocated_pages++;
-		} else {
-			refcount_table[i] = 0;
+		frames[i].refcount = (i < first_free_page) ? 1 : 0;
+		frames[i].flags = (i < first_free_page) ? PAGE_FRAME_PINNED : 0;
+		frames[i].order = 0;
+		frames[i].link = NULL_PAGE_INDEX;
+	}
+	allocated_pages = first_free_page;
+	
+	//carve the free memory into the largest naturally-aligned blocks that fit
+	uint32_t page_ix = first_free_page;
+	while (page_ix < num_pages){
+		uint32_t order = PAGE_ALLOC_MAX_ORDER;
+		while ((page_ix & ((1 << order) - 1)) || page_ix + (1 << order) > num_pages){
+			order--;
 		}
+		free_bitmap(page_ix, order).set(page_ix >> order);
+		page_ix += 1 << order;
 	}
 	
 	uart_puts("allocated_pages = "); uart_puthex(allocated_pages); uart_puts("\r\n");
@@ -31,6 +83,7 @@ PageAlloc::PageAlloc(uint32_t total_memory, refcount_t * table_location){
 }
 
 MemStats PageAlloc::get_mem_stats() {
+	InterruptGuard guard;
 	auto lock = spinlock_cs.acquire();
 	
 	MemStats retval;
@@ -39,123 +92,464 @@ MemStats PageAlloc::get_mem_stats() {
 	retval.usedmem = allocated_pages * PAGE_SIZE;
 	retval.freemem = retval.totalmem - retval.usedmem;
 	
+	//free pages in blocks of each size; pages in the magazines and zeroed pool count as free but in no block
+	uint32_t free_pages = num_pages - allocated_pages;
+	uint32_t section_pages = 0;
+	uint32_t supersection_pages = 0;
+	for (uint32_t order = PAGEBLOCK_ORDER; order < PAGE_ALLOC_NUM_ORDERS; order++){
+		uint32_t pages = free_pageblocks[order - PAGEBLOCK_ORDER].count() << order;
+		
+		section_pages += pages;
+		if (order == PAGE_ALLOC_MAX_ORDER){ //supersections
+			supersection_pages += pages;
+		}
+	}
+	
+	retval.section_fragmentation = free_pages ? (uint64_t)(free_pages - section_pages) * 1000 / free_pages : 0;
+	retval.supersection_fragmentation = free_pages ? (uint64_t)(free_pages - supersection_pages) * 1000 / free_pages : 0;
+	
 	return retval;
 }
 
-//may need optimisation
-uintptr_t PageAlloc::alloc(uint32_t size) {
-	//supports size = {1,4,256}
+//spinlock_cs must be held for all free block operations
+
+//the bitmap a free block of this order belongs in; below a pageblock, that depends on the pageblock's mobility
+HierarchicalBitmap &PageAlloc::free_bitmap(uint32_t page_ix, uint32_t order){
+	if (order >= PAGEBLOCK_ORDER){
+		return free_pageblocks[order - PAGEBLOCK_ORDER];
+	} else {
+		return free_blocks[(uint32_t)pageblock_mobility[page_ix >> PAGEBLOCK_ORDER]][order];
+	}
+}
+
+//returns the upper halves of a block that has been taken out of the free bitmaps until it is the target size
+uint32_t PageAlloc::split_block(uint32_t page_ix, uint32_t order, uint32_t target_order){
+	while (order > target_order){
+		order--;
+		free_bitmap(page_ix, order).set((page_ix >> order) + 1);
+	}
+	
+	return page_ix;
+}
+
+//removes a block of the requested order from the free bitmaps, splitting a larger block if necessary
+//returns NULL_PAGE_INDEX if there is no block large enough
+uint32_t PageAlloc::take_block(uint32_t order, PageMobility mobility){
+	uint32_t block_ix;
+	
+	//a pageblock already split for this mobility
+	for (uint32_t found_order = order; found_order < PAGEBLOCK_ORDER; found_order++){
+		HierarchicalBitmap &bitmap = free_blocks[(uint32_t)mobility][found_order];
+		if ((block_ix = bitmap.find_first()) != BITMAP_NOT_FOUND){
+			bitmap.clear(block_ix);
+			return split_block(block_ix << found_order, found_order, order);
+		}
+	}
+	
+	//a whole pageblock, which is given this mobility if it has to be split below a pageblock
+	for (uint32_t found_order = std::max(order, PAGEBLOCK_ORDER); found_order < PAGE_ALLOC_NUM_ORDERS; found_order++){
+		HierarchicalBitmap &bitmap = free_pageblocks[found_order - PAGEBLOCK_ORDER];
+		if ((block_ix = bitmap.find_first()) != BITMAP_NOT_FOUND){
+			bitmap.clear(block_ix);
+			uint32_t page_ix = block_ix << found_order;
+			
+			if (order < PAGEBLOCK_ORDER){
+				//only the pageblock that is split needs marking; the rest go back as whole pageblocks
+				pageblock_mobility[page_ix >> PAGEBLOCK_ORDER] = mobility;
+			} else {
+				//compaction only moves 4KiB pages, so pageblocks handed out whole are never candidates for it
+				for (uint32_t i = 0; i < (1u << (order - PAGEBLOCK_ORDER)); i++){
+					pageblock_mobility[(page_ix >> PAGEBLOCK_ORDER) + i] = PageMobility::Unmovable;
+				}
+			}
+			return split_block(page_ix, found_order, order);
+		}
+	}
+	
+	//fall back to a pageblock of the other mobility, taking the largest block there is so that its
+	//remainder is left in as few pageblocks as possible
+	for (uint32_t other = 0; other < NUM_PAGE_MOBILITIES; other++){
+		if (other == (uint32_t)mobility){
+			continue;
+		}
+		for (uint32_t found_order = PAGEBLOCK_ORDER; found_order-- > order;){
+			HierarchicalBitmap &bitmap = free_blocks[other][found_order];
+			if ((block_ix = bitmap.find_first()) != BITMAP_NOT_FOUND){
+				bitmap.clear(block_ix);
+				uint32_t page_ix = block_ix << found_order;
+				
+				if (mobility == PageMobility::Unmovable){
+					retag_pageblock(page_ix >> PAGEBLOCK_ORDER, mobility);
+				}
+				return split_block(page_ix, found_order, order);
+			}
+		}
+	}
+	
+	return NULL_PAGE_INDEX;
+}
+
+//moves a split pageblock over to another mobility, along with the free blocks left in it
+void PageAlloc::retag_pageblock(uint32_t pageblock_ix, PageMobility mobility){
+	uint32_t first_ix = pageblock_ix << PAGEBLOCK_ORDER;
+	uint32_t end_ix = std::min(first_ix + (1 << PAGEBLOCK_ORDER), num_pages);
+	uint32_t old_mobility = (uint32_t)pageblock_mobility[pageblock_ix];
+	
+	for (uint32_t order = 0; order < PAGEBLOCK_ORDER; order++){
+		for (uint32_t block_ix = first_ix >> order; block_ix < end_ix >> order; block_ix++){
+			if (free_blocks[old_mobility][order].test(block_ix)){
+				free_blocks[old_mobility][order].clear(block_ix);
+				free_blocks[(uint32_t)mobility][order].set(block_ix);
+			}
+		}
+	}
+	
+	pageblock_mobility[pageblock_ix] = mobility;
+}
+
+//returns a block to the free bitmaps, merging it with its buddy for as long as the buddy is also free
+//a buddy below a pageblock is always in the same pageblock, so it is in the same bitmap
+void PageAlloc::free_block(uint32_t page_ix, uint32_t order){
+	while (order < PAGE_ALLOC_MAX_ORDER){
+		uint32_t buddy_ix = page_ix ^ (1 << order);
+		
+		if (buddy_ix + (1 << order) > num_pages){
+			break;
+		}
+		
+		HierarchicalBitmap &bitmap = free_bitmap(buddy_ix, order);
+		if (!bitmap.test(buddy_ix >> order)){
+			break;
+		}
+		
+		bitmap.clear(buddy_ix >> order);
+		page_ix &= ~(1 << order);
+		order++;
+	}
+	
+	free_bitmap(page_ix, order).set(page_ix >> order);
+}
+
+//the magazine functions must be called with interrupts masked
+//pages sitting in a magazine have a refcount of zero but are not in the free bitmaps, so they never coalesce
+//pages are cached by the mobility of their pageblock
+uint32_t PageAlloc::magazine_alloc(PageMobility mobility){
+	PageMagazine &magazine = magazines[(uint32_t)cpu_get_context()][(uint32_t)mobility];
+	
+	if (magazine.count == 0){
+		magazine.alloc_misses++;
+		
+		auto lock = spinlock_cs.acquire();
+		while (magazine.count < PAGE_MAGAZINE_BATCH){
+			uint32_t page_ix = take_block(0, mobility);
+			if (page_ix == NULL_PAGE_INDEX){
+				break;
+			}
+			magazine.pages[magazine.count++] = page_ix;
+		}
+		
+		if (magazine.count == 0){
+			return NULL_PAGE_INDEX;
+		}
+	} else {
+		magazine.alloc_hits++;
+	}
+	
+	return magazine.pages[--magazine.count];
+}
+
+void PageAlloc::magazine_free(uint32_t page_ix){
+	PageMagazine &magazine = magazines[(uint32_t)cpu_get_context()][(uint32_t)pageblock_mobility[page_ix >> PAGEBLOCK_ORDER]];
+	
+	if (magazine.count == PAGE_MAGAZINE_SIZE){
+		magazine.free_misses++;
+		
+		//the oldest pages are the least likely to still be in the cache
+		auto lock = spinlock_cs.acquire();
+		for (uint32_t i = 0; i < PAGE_MAGAZINE_BATCH; i++){
+			free_block(magazine.pages[i], 0);
+		}
+		for (uint32_t i = PAGE_MAGAZINE_BATCH; i < PAGE_MAGAZINE_SIZE; i++){
+			magazine.pages[i - PAGE_MAGAZINE_BATCH] = magazine.pages[i];
+		}
+		magazine.count -= PAGE_MAGAZINE_BATCH;
+	} else {
+		magazine.free_hits++;
+	}
+	
+	magazine.pages[magazine.count++] = page_ix;
+}
+
+//returns every cached page to the free bitmaps so that it can coalesce again
+//spinlock_cs must be held
+void PageAlloc::flush_magazines(){
+	for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+		for (uint32_t mobility = 0; mobility < NUM_PAGE_MOBILITIES; mobility++){
+			PageMagazine &magazine = magazines[i][mobility];
+			while (magazine.count > 0){
+				free_block(magazine.pages[--magazine.count], 0);
+			}
+		}
+	}
+}
+
+MagazineStats PageAlloc::get_magazine_stats(){
+	InterruptGuard guard;
+	
+	MagazineStats retval = {0, 0, 0, 0, 0};
+	
+	for (uint32_t i = 0; i < NUM_CPU_CONTEXTS; i++){
+		for (uint32_t mobility = 0; mobility < NUM_PAGE_MOBILITIES; mobility++){
+			PageMagazine &magazine = magazines[i][mobility];
+			retval.alloc_hits += magazine.alloc_hits;
+			retval.alloc_misses += magazine.alloc_misses;
+			retval.free_hits += magazine.free_hits;
+			retval.free_misses += magazine.free_misses;
+			retval.cached_pages += magazine.count;
+		}
+	}
+	
+	return retval;
+}
+
+static uint32_t get_alloc_order(uint32_t size){
+	//supports any power of two up to 4096, each aligned to its size; the ones the hardware cares about are
 	//pages are 1 page (4KiB) of memory, aligned to 4KiB
 	//pagetables are 4 pages (16KiB) of memory, aligned to 16KiB
 	//sections are 256 pages (1MiB) of memory, aligned to 1MiB
 	//supersections are 4096 pages (16MiB) of memory, aligned to 16MiB
+	//kmalloc's medium slabs use the orders in between
 	
-	if (size != 1 && size != 4 && size != 256 && size != 4096) {
+	if (size == 0 || (size & (size - 1)) || size > (1u << PAGE_ALLOC_MAX_ORDER)) {
 		panic(PanicCodes::IncompatibleParameter);
 	}
 	
-	//enter critical section
-	auto lock = spinlock_cs.acquire();
+	return __builtin_ctz(size);
+}
+
+//takes a block and gives each of its pages a refcount of 1; the contents are left as they were
+uint32_t PageAlloc::alloc_pages(uint32_t size, PageMobility mobility){
+	uint32_t order = get_alloc_order(size);
 	
-	static uint32_t next_alloc_1 = 0; //page
-	static uint32_t next_alloc_4 = 0; //pagetable
-	static uint32_t next_alloc_256 = 0; //section
-	static uint32_t next_alloc_4096 = 0; //supersection
+	uint32_t entry;
 	
-	uint32_t &next_alloc = (size == 1) ? next_alloc_1 : (size == 4) ? next_alloc_4 : (size == 256) ? next_alloc_256 : next_alloc_4096;
+	{
+		InterruptGuard guard;
 	
-	uint32_t entry = next_alloc;
-	uintptr_t retval = 0;
-	do {
-		bool all_refcounts_zero = true;
+		entry = (size == 1) ? magazine_alloc(mobility) : NULL_PAGE_INDEX;
 		
-		for (uint32_t i = 0; i < size; i++) {
-			if (refcount_table[entry+i] != 0) {
-				all_refcounts_zero = false;
+		if (entry == NULL_PAGE_INDEX){
+			//enter critical section
+			auto lock = spinlock_cs.acquire();
+			
+			entry = take_block(order, mobility);
+			
+			if (entry == NULL_PAGE_INDEX){
+				//the memory may be sitting in the magazines or the zeroed pool
+				flush_magazines();
+				flush_zeroed_pool();
+				entry = take_block(order, mobility);
 			}
+			
+			//exit critical section
 		}
+	}
+	
+	//there may be enough free pages, just not together; interrupts are let in between the calls to compact
+	uint32_t compaction_calls = (num_pages + PAGE_COMPACTION_SCAN_PAGES - 1) / PAGE_COMPACTION_SCAN_PAGES;
+	for (uint32_t i = 0; entry == NULL_PAGE_INDEX && order >= PAGEBLOCK_ORDER && i < compaction_calls; i++){
+		InterruptGuard guard;
+		auto lock = spinlock_cs.acquire();
 		
-		if (all_refcounts_zero) {
-			//use this section
-			for (uint32_t i = 0; i < size; i++) {
-				refcount_table[entry+i] = 1;
-#ifdef VERBOSE					
-				uart_puts("page_alloc: Acquire ");
-				uart_puthex((entry+i)*PAGE_SIZE);
-				uart_putline();
+		//something freed in between may have made room
+		entry = take_block(order, mobility);
+		
+		if (entry == NULL_PAGE_INDEX){
+			entry = compact(order);
+		}
+	}
+	
+	if (entry == NULL_PAGE_INDEX){
+		panic(PanicCodes::OutOfMemory);
+	}
+	
+	//the block is out of the free bitmaps, so only allocated_pages is shared
+	InterruptGuard guard;
+	
+	uint8_t flags = (mobility == PageMobility::Movable) ? PAGE_FRAME_MOVABLE : 0;
+	for (uint32_t i = 0; i < size; i++) {
+		frames[entry+i].refcount = 1;
+		frames[entry+i].flags = flags;
+	}
+	frames[entry].order = order;
+#ifdef VERBOSE
+	for (uint32_t i = 0; i < size; i++) {
+		uart_puts("page_alloc: Acquire ");
+		uart_puthex((entry+i)*PAGE_SIZE);
+		uart_putline();
+	}
 #endif
+	allocated_pages += size;
+	
+	return entry;
+}
+
+uintptr_t PageAlloc::alloc(uint32_t size, PageMobility mobility) {
+	uintptr_t retval = alloc_pages(size, mobility) * PAGE_SIZE;
+	
+#ifdef PAGE_ALLOC_POISON
+	//fill the whole block with 0xcc to catch use of uninitialised memory
+	memset(retval, 0xcc, size * PAGE_SIZE);
+#endif
+	
+	return retval;
+}
+
+uintptr_t PageAlloc::alloc_zeroed(uint32_t size, PageMobility mobility) {
+	if (size == 1 && mobility == PageMobility::Unmovable){
+		InterruptGuard guard;
+		
+		uint32_t entry = zeroed_pool_head;
+		if (entry != NULL_PAGE_INDEX){
+			PageFrame &frame = frames[entry];
+			zeroed_pool_head = frame.link;
+			zeroed_pool_count--;
+			
+			frame.link = NULL_PAGE_INDEX;
+			frame.flags = 0;
+			frame.order = 0;
+			frame.refcount = 1;
+			allocated_pages++;
+			
+			return entry * PAGE_SIZE;
+		}
+	}
+	
+	//nothing pre-zeroed, so do it now
+	uintptr_t retval = alloc_pages(size, mobility) * PAGE_SIZE;
+	memzero(retval, size * PAGE_SIZE);
+	
+	return retval;
+}
+
+uint32_t PageAlloc::refill_zeroed_pool(uint32_t max_pages){
+	uint32_t pages_zeroed = 0;
+	
+	while (pages_zeroed < max_pages){
+		uint32_t entry;
+		
+		{
+			InterruptGuard guard;
+			
+			if (zeroed_pool_count >= ZEROED_POOL_TARGET){
+				break;
 			}
-			retval = entry * PAGE_SIZE;
-			allocated_pages += size;
+			
+			auto lock = spinlock_cs.acquire();
+			entry = take_block(0, PageMobility::Unmovable);
 		}
-		entry += size;
 		
-		if (entry >= num_pages){
-			entry -= num_pages;
+		if (entry == NULL_PAGE_INDEX){
+			break;
 		}
 		
-		if (entry == next_alloc){
-			panic(PanicCodes::OutOfMemory); //give up
+		//the page belongs to nobody while it is being zeroed, so this can be interrupted
+		uintptr_t page = entry * PAGE_SIZE;
+		memzero(page, PAGE_SIZE);
+		pages_zeroed++;
+		
+		{
+			InterruptGuard guard;
+			
+			frames[entry].flags = PAGE_FRAME_ZEROED;
+			frames[entry].link = zeroed_pool_head;
+			zeroed_pool_head = entry;
+			zeroed_pool_count++;
 		}
-	} while (retval == 0);
+	}
+	
+	return pages_zeroed;
+}
+
+//spinlock_cs must be held and interrupts masked
+void PageAlloc::flush_zeroed_pool(){
+	while (zeroed_pool_head != NULL_PAGE_INDEX){
+		uint32_t entry = zeroed_pool_head;
+		
+		zeroed_pool_head = frames[entry].link;
+		frames[entry].link = NULL_PAGE_INDEX;
+		frames[entry].flags = 0;
+		
+		free_block(entry, 0);
+	}
+	zeroed_pool_count = 0;
+}
+
+//refcounts are changed with exclusive loads and stores (ldrexh/strexh), without masking interrupts or taking
+//spinlock_cs; only a release that takes a page to zero goes back to the allocator for it
+//taking another reference needs no ordering, since the caller already holds one; dropping one orders the
+//caller's accesses to the page before whoever frees it
+
+//a bad count panics, so it doesn't matter that it has already been stored by the time it is checked
+static inline uint32_t frame_acquire(PageFrame &frame){
+	uint32_t refcount = __atomic_fetch_add(&frame.refcount, 1, __ATOMIC_RELAXED);
 	
-	next_alloc = entry;
+	if (refcount == 0) {
+		panic(PanicCodes::AddRefToUnallocatedPage);
+	} else if (refcount == PAGE_MAX_REFCOUNT) {
+		panic(PanicCodes::TooManyReferences);
+	}
 	
-	//exit critical section
-	//spinlock_flag.clear(std::memory_order_release);
+	return refcount + 1;
+}
+
+//the caller owns the page once this returns zero
+static inline uint32_t frame_release(PageFrame &frame){
+	uint32_t refcount = __atomic_fetch_sub(&frame.refcount, 1, __ATOMIC_ACQ_REL);
 	
-	//clear page to 0xcc for security/debugging
-	memset(retval, 0xcc, PAGE_SIZE);
+	if (refcount == 0) {
+		panic(PanicCodes::ReleaseUnallocatedPage);
+	} else if (refcount == 1) {
+		frame.flags = 0;
+		frame.order = 0;
+		frame.link = NULL_PAGE_INDEX;
+	}
 	
-	return retval;
+	return refcount - 1;
 }
 
 uint32_t PageAlloc::ref_acquire(uintptr_t page){
-	//enter critical section
-	auto lock = spinlock_cs.acquire();
-	
 	uint32_t retval = 0;
 	
 	uint32_t page_ix = page / PAGE_SIZE;
 	
-	if (page_ix > num_pages) return 0; //no-op (good for mmio etc)
+	if (page_ix >= num_pages) return 0; //no-op (good for mmio etc)
 	
-	if (refcount_table[page_ix] == 0) {
-		panic(PanicCodes::AddRefToUnallocatedPage);
-	} else {
-		retval = ++refcount_table[page_ix];
-	}
+	retval = frame_acquire(frames[page_ix]);
 	
 #ifdef VERBOSE					
 	uart_puts("page_alloc: Acquire ");
 	uart_puthex(page);
 	uart_putline();
 #endif
-
-	//exit critical section
-	//spinlock_flag.clear(std::memory_order_release);
 	
 	return retval;
 }
 
 uint32_t PageAlloc::ref_release(uintptr_t page){
-	//enter critical section
-	auto lock = spinlock_cs.acquire();
-	
 	uint32_t retval = 0;
 	
 	uint32_t page_ix = page / PAGE_SIZE;
 	
-	if (page_ix > num_pages) return 0; //no-op (good for mmio etc)
+	if (page_ix >= num_pages) return 0; //no-op (good for mmio etc)
 	
-	if (refcount_table[page_ix] == 0) {
-		panic(PanicCodes::ReleaseUnallocatedPage);
-	} else {
-		retval = --refcount_table[page_ix];
-	}
+	retval = frame_release(frames[page_ix]);
 	
 	if (retval == 0) {
+		InterruptGuard guard;
+		
 		allocated_pages--;
+		magazine_free(page_ix);
 	}
 
 #ifdef VERBOSE					
@@ -163,22 +557,336 @@ uint32_t PageAlloc::ref_release(uintptr_t page){
 	uart_puthex(page);
 	uart_putline();
 #endif
-
-	//exit critical section
-	//spinlock_flag.clear(std::memory_order_release);
 	
 	return retval;
 }
 
-void PageAlloc::ref_acquire(uintptr_t page, uint32_t size){
-	for (uint32_t i = 0; i < size; i++){
-		ref_acquire(page + i * PAGE_SIZE);
+void PageAlloc::alloc_bulk(uint32_t count, uintptr_t out[], PageMobility mobility){
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	uint32_t filled = 0;
+	while (filled < count){
+		//take the biggest block that is both needed and available, and hand it out page by page
+		uint32_t order = std::min((uint32_t)(31 - __builtin_clz(count - filled)), PAGE_ALLOC_MAX_ORDER);
+		uint32_t entry;
+		
+		while ((entry = take_block(order, mobility)) == NULL_PAGE_INDEX && order > 0){
+			order--;
+		}
+		
+		if (entry == NULL_PAGE_INDEX){
+			//the memory may be sitting in the magazines or the zeroed pool
+			flush_magazines();
+			flush_zeroed_pool();
+			entry = take_block(0, mobility);
+		}
+		
+		if (entry == NULL_PAGE_INDEX){
+			panic(PanicCodes::OutOfMemory);
+		}
+		
+		for (uint32_t i = 0; i < (1u << order); i++){
+			frames[entry + i].refcount = 1;
+			frames[entry + i].flags = (mobility == PageMobility::Movable) ? PAGE_FRAME_MOVABLE : 0;
+			out[filled++] = (entry + i) * PAGE_SIZE;
+		}
+		allocated_pages += 1 << order;
+	}
+}
+
+//returns a run of pages whose refcounts have just reached zero to the free bitmaps
+//spinlock_cs must be held and interrupts masked
+void PageAlloc::free_run(uint32_t page_ix, uint32_t num_run_pages){
+	allocated_pages -= num_run_pages;
+	
+	free_range(page_ix, num_run_pages);
+}
+
+//returns unallocated pages that are in none of the free bitmaps to them as the largest aligned blocks possible
+//spinlock_cs must be held and interrupts masked
+void PageAlloc::free_range(uint32_t page_ix, uint32_t num_range_pages){
+	while (num_range_pages > 0){
+		uint32_t order = std::min((uint32_t)(31 - __builtin_clz(num_range_pages)), PAGE_ALLOC_MAX_ORDER);
+		if (page_ix != 0){
+			order = std::min(order, (uint32_t)__builtin_ctz(page_ix));
+		}
+		
+		free_block(page_ix, order);
+		
+		page_ix += 1 << order;
+		num_range_pages -= 1 << order;
 	}
 }
 
-void PageAlloc::ref_release(uintptr_t page, uint32_t size){
-	for (uint32_t i = 0; i < size; i++){
-		ref_release(page + i * PAGE_SIZE);
+void PageAlloc::ref_acquire_range(uintptr_t page, uint32_t size){
+	uint32_t page_ix = page / PAGE_SIZE;
+	
+	if (page_ix >= num_pages) return; //no-op (good for mmio etc)
+	
+	uint32_t end_ix = std::min(page_ix + size, num_pages);
+	
+	for (; page_ix < end_ix; page_ix++){
+		frame_acquire(frames[page_ix]);
+	}
+}
+
+void PageAlloc::ref_release_range(uintptr_t page, uint32_t size){
+	uint32_t page_ix = page / PAGE_SIZE;
+	
+	if (page_ix >= num_pages) return; //no-op (good for mmio etc)
+	
+	uint32_t end_ix = std::min(page_ix + size, num_pages);
+	
+	//pages that reach zero go straight back to the free bitmaps, taking the lock once for each run of them
+	uint32_t run_start = page_ix;
+	uint32_t run_length = 0;
+	
+	for (; page_ix <= end_ix; page_ix++){
+		if (page_ix < end_ix && frame_release(frames[page_ix]) == 0){
+			if (run_length == 0){
+				run_start = page_ix;
+			}
+			run_length++;
+		} else if (run_length > 0){
+			InterruptGuard guard;
+			auto lock = spinlock_cs.acquire();
+			
+			free_run(run_start, run_length);
+			run_length = 0;
+		}
+	}
+}
+
+uint32_t PageAlloc::get_num_pages(){
+	return num_pages;
+}
+
+PageFrame PageAlloc::get_page_frame(uintptr_t page){
+	uint32_t page_ix = page / PAGE_SIZE;
+	
+	if (page_ix >= num_pages){
+		panic(PanicCodes::IncompatibleParameter);
+	}
+	
+	InterruptGuard guard;
+	return frames[page_ix];
+}
+
+void PageAlloc::set_page_flags(uintptr_t page, uint32_t size, uint8_t flags){
+	uint32_t page_ix = page / PAGE_SIZE;
+	uint32_t end_ix = std::min(page_ix + size, num_pages);
+	
+	InterruptGuard guard;
+	
+	for (; page_ix < end_ix; page_ix++){
+		if (frames[page_ix].refcount == 0) {
+			panic(PanicCodes::IncompatibleParameter);
+		}
+		frames[page_ix].flags |= flags;
+	}
+}
+
+void PageAlloc::clear_page_flags(uintptr_t page, uint32_t size, uint8_t flags){
+	uint32_t page_ix = page / PAGE_SIZE;
+	uint32_t end_ix = std::min(page_ix + size, num_pages);
+	
+	InterruptGuard guard;
+	
+	for (; page_ix < end_ix; page_ix++){
+		frames[page_ix].flags &= ~flags;
 	}
 }
 
+void PageAlloc::set_page_link(uintptr_t page, uint32_t size, uint32_t link){
+	uint32_t page_ix = page / PAGE_SIZE;
+	uint32_t end_ix = std::min(page_ix + size, num_pages);
+	
+	InterruptGuard guard;
+	
+	for (; page_ix < end_ix; page_ix++){
+		if (frames[page_ix].refcount == 0) {
+			panic(PanicCodes::IncompatibleParameter);
+		}
+		frames[page_ix].link = link;
+	}
+}
+
+void PageAlloc::add_movable_table(PageTable * table){
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	table->next_movable_table = movable_tables;
+	movable_tables = table;
+}
+
+void PageAlloc::remove_movable_table(PageTable * table){
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	for (PageTable ** link = &movable_tables; *link != nullptr; link = &(*link)->next_movable_table){
+		if (*link == table){
+			*link = table->next_movable_table;
+			break;
+		}
+	}
+}
+
+//the compaction functions must be called with spinlock_cs held and interrupts masked
+
+//returns the number of allocated pages in a block, or NULL_PAGE_INDEX if any of them can't be moved
+uint32_t PageAlloc::count_movable_pages(uint32_t page_ix, uint32_t num_block_pages){
+	uint32_t used_pages = 0;
+	
+	for (uint32_t pageblock_ix = page_ix; pageblock_ix < page_ix + num_block_pages; pageblock_ix += 1 << PAGEBLOCK_ORDER){
+		uint32_t pageblock_used_pages = 0;
+		
+		for (uint32_t i = pageblock_ix; i < pageblock_ix + (1 << PAGEBLOCK_ORDER); i++){
+			PageFrame &frame = frames[i];
+			if (frame.refcount == 0){
+				continue;
+			}
+			
+			if (frame.refcount > 1 || frame.flags != PAGE_FRAME_MOVABLE){
+				//mapped more than once, held by something other than its table, or never owned by a table at all
+				//(kernel data, slabs, page tables)
+				return NULL_PAGE_INDEX;
+			}
+			pageblock_used_pages++;
+		}
+		
+		if (pageblock_used_pages > 0 && pageblock_mobility[pageblock_ix >> PAGEBLOCK_ORDER] != PageMobility::Movable){
+			return NULL_PAGE_INDEX;
+		}
+		used_pages += pageblock_used_pages;
+	}
+	
+	return used_pages;
+}
+
+//takes every free block inside a block out of the free bitmaps, so that pages moved out of it can't land back in it
+void PageAlloc::isolate_block(uint32_t page_ix, uint32_t order){
+	for (uint32_t free_order = 0; free_order < order; free_order++){
+		for (uint32_t free_ix = page_ix; free_ix < page_ix + (1 << order); free_ix += 1 << free_order){
+			HierarchicalBitmap &bitmap = free_bitmap(free_ix, free_order);
+			if (bitmap.test(free_ix >> free_order)){
+				bitmap.clear(free_ix >> free_order);
+			}
+		}
+	}
+}
+
+//empties one block of a pageblock or larger by moving the pages in it elsewhere, choosing it from the candidates in the
+//next PAGE_COMPACTION_SCAN_PAGES pages
+//returns the first page of the block, which is left out of the free bitmaps, or NULL_PAGE_INDEX
+uint32_t PageAlloc::compact(uint32_t order){
+	uint32_t num_block_pages = 1 << order;
+	if (num_block_pages > num_pages){
+		return NULL_PAGE_INDEX;
+	}
+	
+	uint32_t num_candidates = std::min(std::max(PAGE_COMPACTION_SCAN_PAGES >> order, 1u), num_pages >> order);
+	uint32_t best_ix = NULL_PAGE_INDEX;
+	uint32_t best_used_pages = PAGE_COMPACTION_MAX_MOVES + 1;
+		
+	for (uint32_t i = 0; i < num_candidates; i++){
+		//candidates are aligned to their size, and the scan wraps round at the end of memory
+		uint32_t page_ix = compaction_cursor & ~(num_block_pages - 1);
+		if (page_ix + num_block_pages > num_pages){
+			page_ix = 0;
+		}
+		compaction_cursor = page_ix + num_block_pages;
+			
+		uint32_t used_pages = count_movable_pages(page_ix, num_block_pages);
+		if (used_pages < best_used_pages){
+			best_ix = page_ix;
+			best_used_pages = used_pages;
+		}
+	}
+		
+	if (best_ix == NULL_PAGE_INDEX){
+		return NULL_PAGE_INDEX;
+	}
+		
+	//the pages have to fit outside the block
+	uint32_t free_pages_outside = (num_pages - allocated_pages) - (num_block_pages - best_used_pages);
+	if (best_used_pages > free_pages_outside){
+		return NULL_PAGE_INDEX;
+	}
+		
+#ifdef VERBOSE
+	uart_puts("page_alloc: Compacting ");
+	uart_puthex(best_ix * PAGE_SIZE);
+	uart_puts(", moving ");
+	uart_putdec(best_used_pages);
+	uart_puts(" pages\r\n");
+#endif
+		
+	isolate_block(best_ix, order);
+		
+	compaction_start = best_ix;
+	compaction_end = best_ix + num_block_pages;
+	for (PageTable * table = movable_tables; table != nullptr; table = table->next_movable_table){
+		table->migrate_pages(compaction_start * PAGE_SIZE, compaction_end * PAGE_SIZE);
+	}
+	compaction_start = 0;
+	compaction_end = 0;
+	
+	uint32_t first_stuck_ix = NULL_PAGE_INDEX;
+	for (uint32_t i = best_ix; i < best_ix + num_block_pages; i++){
+		if (frames[i].refcount != 0){
+			first_stuck_ix = i;
+			break;
+		}
+	}
+		
+	if (first_stuck_ix == NULL_PAGE_INDEX){
+		//handed out whole, like take_block's whole pageblocks
+		for (uint32_t i = 0; i < (num_block_pages >> PAGEBLOCK_ORDER); i++){
+			pageblock_mobility[(best_ix >> PAGEBLOCK_ORDER) + i] = PageMobility::Unmovable;
+		}
+		return best_ix;
+	}
+	
+	//something in the block wasn't found in any table (or there was nowhere to put it), so give the free pages back;
+	//the pages that were moved stay moved
+	uint32_t run_start = best_ix;
+	for (uint32_t i = best_ix; i <= best_ix + num_block_pages; i++){
+		if (i == best_ix + num_block_pages || frames[i].refcount != 0){
+			if (i > run_start){
+				free_range(run_start, i - run_start);
+			}
+			run_start = i + 1;
+		}
+	}
+	
+	return NULL_PAGE_INDEX;
+}
+
+//called back by PageTable::migrate_pages for each page it maps in the block being compacted
+//copies the page somewhere outside the block and moves its reference over; returns the new page, or 0 if it can't be moved
+uintptr_t PageAlloc::migrate_page(uintptr_t page){
+	uint32_t page_ix = page / PAGE_SIZE;
+	
+	PageFrame &frame = frames[page_ix];
+	
+	if (page_ix < compaction_start || page_ix >= compaction_end || frame.refcount != 1 || frame.flags != PAGE_FRAME_MOVABLE){
+		return 0;
+	}
+	
+	uint32_t new_page_ix = take_block(0, PageMobility::Movable);
+	if (new_page_ix == NULL_PAGE_INDEX){
+		return 0;
+	}
+	
+	uintptr_t new_page = new_page_ix * PAGE_SIZE;
+	memcpy(new_page, page, PAGE_SIZE);
+	
+	frames[new_page_ix] = frame;
+	frame.refcount = 0;
+	frame.flags = 0;
+	frame.order = 0;
+	frame.link = NULL_PAGE_INDEX;
+	
+	return new_page;
+}
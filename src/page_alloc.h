@@ -2,28 +2,166 @@
 
 #include "common.h"
 #include "spinlock.h"
+#include "cpu.h"
+#include "bitmap.h"
+
+class PageTable;
 
 struct MemStats {
 	uint32_t totalmem;
 	uint32_t freemem;
 	uint32_t usedmem;
+	
+	//per-mille of free memory that can't be handed out as a section (or supersection) because it is in smaller blocks;
+	//0 means every free page is in a free section, 1000 means no section allocation can succeed
+	uint32_t section_fragmentation;
+	uint32_t supersection_fragmentation;
+};
+
+const uint32_t NULL_PAGE_INDEX = 0xffffffff;
+
+//everything the allocator knows about a physical page; frames are 8 bytes, so four share a cache line
+struct PageFrame {
+	uint16_t refcount; //zero while the page is free, even if it is cached in a magazine or the zeroed pool
+	uint8_t flags;
+	uint8_t order; //of the block, in the first frame of an allocated block
+	uint32_t link; //page index of the next frame in whatever list the page is on, or NULL_PAGE_INDEX; the owner's to set while allocated
+};
+
+static_assert(sizeof(PageFrame) == 8, "PageFrame should pack into 8 bytes");
+
+const uint32_t PAGE_MAX_REFCOUNT = 0xffff;
+
+//frame flags; apart from PAGE_FRAME_ZEROED and PAGE_FRAME_MOVABLE, these are set by the owner of a page and cleared
+//when it is freed
+const uint8_t PAGE_FRAME_ZEROED = 0x01; //in the zeroed pool
+const uint8_t PAGE_FRAME_PINNED = 0x02; //its physical address is held outside any PageTable, so compaction can't move it
+const uint8_t PAGE_FRAME_PAGE_TABLE = 0x04;
+const uint8_t PAGE_FRAME_SLAB = 0x08;
+const uint8_t PAGE_FRAME_DMA = 0x10; //reserved for DMA, so compaction can't move it
+const uint8_t PAGE_FRAME_MOVABLE = 0x20; //allocated as movable, so only reachable through a reference-counted PageTable
+
+//buddy orders 0..12 cover pages (1), pagetables (4), sections (256) and supersections (4096)
+const uint32_t PAGE_ALLOC_MAX_ORDER = 12;
+const uint32_t PAGE_ALLOC_NUM_ORDERS = PAGE_ALLOC_MAX_ORDER + 1;
+
+//memory is grouped into 1MiB pageblocks; blocks smaller than a pageblock are only split off pageblocks of the same
+//mobility, so that long-lived unmovable pages collect in a few pageblocks instead of pinning a page in every section
+//a pageblock takes the mobility of the first allocation that splits it, and only once no pageblock of the right
+//mobility has room does an allocation fall back to taking a block from a pageblock of the other mobility
+//an unmovable allocation that falls back takes the whole pageblock over, free blocks and all, so that compaction
+//never tries to empty a pageblock it has put an unmovable page in; a movable one leaves the pageblock unmovable
+const uint32_t PAGEBLOCK_ORDER = 8;
+
+enum class PageMobility : uint8_t {
+	Unmovable, //kernel data, page tables, anything whose physical address is held onto
+	Movable, //only reachable through a reference-counted PageTable, which can be remapped
+};
+
+const uint32_t NUM_PAGE_MOBILITIES = 2;
+
+//single pages are allocated from and freed to a small per-context stack (magazine) without taking
+//spinlock_cs; magazines are refilled from and drained to the buddy free bitmaps in batches
+const uint32_t PAGE_MAGAZINE_SIZE = 16;
+const uint32_t PAGE_MAGAZINE_BATCH = 8;
+
+struct PageMagazine {
+	uint32_t count;
+	uint32_t pages[PAGE_MAGAZINE_SIZE];
+	
+	uint32_t alloc_hits;
+	uint32_t alloc_misses; //refills
+	uint32_t free_hits;
+	uint32_t free_misses; //drains
 };
 
-typedef uint8_t refcount_t;
+//pages zeroed ahead of time by refill_zeroed_pool, so that alloc_zeroed(1) doesn't have to
+//the loader fills the pool once; after that it is only topped up when the kernel's idle loop or timer tick calls
+//refill_zeroed_pool, never on the free path, where the zeroing would run under whatever locks the caller holds
+const uint32_t ZEROED_POOL_TARGET = 64;
+
+//when no section or supersection is free, compaction empties a candidate block by moving the 4KiB pages that
+//reference-counted PageTables have allocated into it; a candidate block can only hold pages allocated as movable
+//with a refcount of 1, and nothing is moved out of a block with any other page in it
+//each call to compact runs with interrupts masked, so it is bounded: it looks at the candidate blocks in the next
+//PAGE_COMPACTION_SCAN_PAGES pages from where the last call left off, and only empties the one with the fewest pages
+//to move if that is at most PAGE_COMPACTION_MAX_MOVES; alloc lets interrupts in between calls, and gives up once the
+//calls have been through all of memory
+const uint32_t PAGE_COMPACTION_SCAN_PAGES = 4096;
+const uint32_t PAGE_COMPACTION_MAX_MOVES = 256;
+
+struct MagazineStats {
+	uint32_t alloc_hits;
+	uint32_t alloc_misses;
+	uint32_t free_hits;
+	uint32_t free_misses;
+	uint32_t cached_pages;
+};
 
 class PageAlloc {
 private:
-	refcount_t * refcount_table;
+	PageFrame * frames;
+	//bit n of order k is set if block n of 2^k pages is free and unsplit
+	HierarchicalBitmap free_blocks[NUM_PAGE_MOBILITIES][PAGEBLOCK_ORDER]; //below a pageblock, by the mobility of the pageblock
+	HierarchicalBitmap free_pageblocks[PAGE_ALLOC_NUM_ORDERS - PAGEBLOCK_ORDER]; //whole pageblocks and larger
+	PageMobility * pageblock_mobility; //only meaningful while a pageblock is split
 	uint32_t num_pages;
 	uint32_t allocated_pages = 0;
 	Spinlock spinlock_cs;
+	PageMagazine magazines[NUM_CPU_CONTEXTS][NUM_PAGE_MOBILITIES];
+	uint32_t zeroed_pool_head; //unmovable pages, linked through their frames
+	uint32_t zeroed_pool_count;
+	PageTable * movable_tables; //reference-counted tables, linked through next_movable_table
+	uint32_t compaction_cursor; //where the next call to compact starts looking
+	uint32_t compaction_start; //the block being emptied by compact, if any
+	uint32_t compaction_end;
+
+	HierarchicalBitmap &free_bitmap(uint32_t page_ix, uint32_t order);
+	uint32_t split_block(uint32_t page_ix, uint32_t order, uint32_t target_order);
+	uint32_t take_block(uint32_t order, PageMobility mobility);
+	void retag_pageblock(uint32_t pageblock_ix, PageMobility mobility);
+	void free_block(uint32_t page_ix, uint32_t order);
+	
+	uint32_t magazine_alloc(PageMobility mobility);
+	void magazine_free(uint32_t page_ix);
+	void flush_magazines();
+	
+	uint32_t alloc_pages(uint32_t size, PageMobility mobility);
+	void flush_zeroed_pool();
+	void free_run(uint32_t page_ix, uint32_t num_run_pages);
+	void free_range(uint32_t page_ix, uint32_t num_range_pages);
+	
+	friend class PageTable;
+	uint32_t count_movable_pages(uint32_t page_ix, uint32_t num_block_pages);
+	void isolate_block(uint32_t page_ix, uint32_t order);
+	uint32_t compact(uint32_t order);
+	uintptr_t migrate_page(uintptr_t page);
 public:
-	PageAlloc(uint32_t total_memory, refcount_t * table_location); //table_location is also the end of used memory
-	uintptr_t alloc(uint32_t size);
+	PageAlloc(uint32_t total_memory, PageFrame * table_location); //table_location is also the end of used memory
+	//size is a power of two up to a supersection (4096 pages), and the block is aligned to its size
+	uintptr_t alloc(uint32_t size, PageMobility mobility = PageMobility::Unmovable); //contents are undefined (0xcc if PAGE_ALLOC_POISON is defined)
+	uintptr_t alloc_zeroed(uint32_t size, PageMobility mobility = PageMobility::Unmovable);
+	uint32_t refill_zeroed_pool(uint32_t max_pages = ZEROED_POOL_TARGET); //call when idle; returns the number of pages zeroed
+	//refcounts are changed atomically; only a release to zero masks interrupts and (if the magazine is full) takes spinlock_cs
 	uint32_t ref_acquire(uintptr_t page);
 	uint32_t ref_release(uintptr_t page);
-	void ref_acquire(uintptr_t page, uint32_t size);
-	void ref_release(uintptr_t page, uint32_t size);
+	
+	//alloc_bulk masks interrupts and takes spinlock_cs once for the whole call;
+	//ref_release_range only does so once for each run of pages whose refcounts reach zero
+	void alloc_bulk(uint32_t count, uintptr_t out[], PageMobility mobility = PageMobility::Unmovable); //count single pages
+	void ref_acquire_range(uintptr_t page, uint32_t size);
+	void ref_release_range(uintptr_t page, uint32_t size);
+	
+	uint32_t get_num_pages(); //pages from num_pages * PAGE_SIZE up aren't RAM, and have no frame
+	PageFrame get_page_frame(uintptr_t page);
+	void set_page_flags(uintptr_t page, uint32_t size, uint8_t flags); //on every page of an allocated block
+	void clear_page_flags(uintptr_t page, uint32_t size, uint8_t flags);
+	void set_page_link(uintptr_t page, uint32_t size, uint32_t link); //reset to NULL_PAGE_INDEX when the page is freed
+	
+	//tables whose allocated pages compaction may move
+	void add_movable_table(PageTable * table);
+	void remove_movable_table(PageTable * table);
+	
 	MemStats get_mem_stats();
+	MagazineStats get_magazine_stats();
 };
-
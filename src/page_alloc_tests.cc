@@ -0,0 +1,306 @@
+#include "runtime_tests.h"
+#include "uart.h"
+#include "utility.h"
+#include "page_alloc.h"
+
+//whether the free memory is in the same shape as it was: the fragmentation figures only come back if every block
+//freed since has coalesced with its buddies again
+static bool same_free_blocks(MemStats a, MemStats b){
+	return a.usedmem == b.usedmem && a.section_fragmentation == b.section_fragmentation && a.supersection_fragmentation == b.supersection_fragmentation;
+}
+
+static bool is_zeroed(uintptr_t block, uint32_t size){
+	uint32_t * words = (uint32_t*)block;
+	for (uint32_t i = 0; i < size * PAGE_SIZE / sizeof(uint32_t); i++){
+		if (words[i] != 0){
+			return false;
+		}
+	}
+	return true;
+}
+
+bool test_page_alloc(PageAlloc &page_alloc) {
+	bool all_passed = true;
+	
+	MemStats stats_i = page_alloc.get_mem_stats();
+	
+	uart_puts("Buddy blocks are split to size and aligned: ");
+	{
+		//orders above 0, which don't go through the magazines
+		uintptr_t blocks[PAGE_ALLOC_NUM_ORDERS];
+		for (uint32_t order = 1; order < PAGE_ALLOC_NUM_ORDERS; order++){
+			blocks[order] = page_alloc.alloc(1 << order);
+			all_passed &= blocks[order] % (PAGE_SIZE << order) == 0;
+			all_passed &= page_alloc.get_page_frame(blocks[order]).order == order;
+		}
+		
+		for (uint32_t a = 1; a < PAGE_ALLOC_NUM_ORDERS; a++){
+			for (uint32_t b = a + 1; b < PAGE_ALLOC_NUM_ORDERS; b++){
+				bool disjoint = blocks[a] + (PAGE_SIZE << a) <= blocks[b] || blocks[b] + (PAGE_SIZE << b) <= blocks[a];
+				all_passed &= disjoint;
+			}
+		}
+		
+		MemStats stats = page_alloc.get_mem_stats();
+		all_passed &= stats.usedmem - stats_i.usedmem == ((1u << PAGE_ALLOC_NUM_ORDERS) - 2) * PAGE_SIZE;
+		
+		for (uint32_t order = 1; order < PAGE_ALLOC_NUM_ORDERS; order++){
+			page_alloc.ref_release_range(blocks[order], 1 << order);
+		}
+		
+		all_passed &= same_free_blocks(stats_i, page_alloc.get_mem_stats());
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Buddy blocks coalesce page by page: ");
+	{
+		const uint32_t section_pages = 1 << PAGEBLOCK_ORDER;
+		uintptr_t section = page_alloc.alloc(section_pages);
+		
+		//the odd pages first, so that nothing can merge until the even ones come back
+		for (uint32_t i = 1; i < section_pages; i += 2){
+			page_alloc.ref_release_range(section + i * PAGE_SIZE, 1);
+		}
+		all_passed &= page_alloc.get_mem_stats().usedmem - stats_i.usedmem == section_pages / 2 * PAGE_SIZE;
+		
+		for (uint32_t i = 0; i < section_pages; i += 2){
+			page_alloc.ref_release_range(section + i * PAGE_SIZE, 1);
+		}
+		
+		all_passed &= same_free_blocks(stats_i, page_alloc.get_mem_stats());
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Hierarchical bitmap finds bits across words and levels: ");
+	{
+		//three levels of 65, 3 and 1 words
+		const uint32_t num_bits = 32 * 32 * 2 + 5;
+		const uint32_t num_words = 65 + 3 + 1;
+		uint32_t storage[num_words + 1];
+		storage[num_words] = 0xdeadbeef;
+		
+		all_passed &= HierarchicalBitmap::get_storage_words(num_bits) == num_words;
+		
+		HierarchicalBitmap bitmap;
+		bitmap.init(storage, num_bits);
+		all_passed &= bitmap.find_first() == BITMAP_NOT_FOUND && bitmap.count() == 0;
+		
+		//the very last bit, the first and last bits under a second-level word, and either side of a bottom word
+		const uint32_t bits[] = {num_bits - 1, 1024, 1023, 32, 31};
+		const uint32_t num_test_bits = sizeof(bits) / sizeof(bits[0]);
+		for (uint32_t i = 0; i < num_test_bits; i++){
+			bitmap.set(bits[i]);
+			all_passed &= bitmap.find_first() == bits[i];
+		}
+		all_passed &= bitmap.count() == num_test_bits;
+		
+		//clearing the lowest bit finds the next one up, wherever its summary bits are
+		for (uint32_t i = num_test_bits; i-- > 0;){
+			all_passed &= bitmap.test(bits[i]);
+			bitmap.clear(bits[i]);
+			all_passed &= !bitmap.test(bits[i]);
+			all_passed &= bitmap.find_first() == (i > 0 ? bits[i - 1] : BITMAP_NOT_FOUND);
+		}
+		all_passed &= bitmap.count() == 0;
+		
+		//a summary bit stays set until the last bit under it is cleared
+		bitmap.set(1025);
+		bitmap.set(1026);
+		bitmap.clear(1025);
+		all_passed &= bitmap.find_first() == 1026;
+		bitmap.clear(1026);
+		all_passed &= bitmap.find_first() == BITMAP_NOT_FOUND;
+		
+		all_passed &= storage[num_words] == 0xdeadbeef;
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Magazines refill and drain in batches: ");
+	{
+		MagazineStats magazines_i = page_alloc.get_magazine_stats();
+		
+		//take pages until the magazine runs dry and is refilled, which leaves it one short of a batch
+		uintptr_t taken[PAGE_MAGAZINE_SIZE + 1];
+		uint32_t num_taken = 0;
+		do {
+			taken[num_taken++] = page_alloc.alloc(1);
+		} while (page_alloc.get_magazine_stats().alloc_misses == magazines_i.alloc_misses && num_taken < PAGE_MAGAZINE_SIZE + 1);
+		
+		MagazineStats magazines = page_alloc.get_magazine_stats();
+		all_passed &= magazines.alloc_misses == magazines_i.alloc_misses + 1;
+		all_passed &= magazines.cached_pages == magazines_i.cached_pages - (num_taken - 1) + (PAGE_MAGAZINE_BATCH - 1);
+		
+		//pages from the buddy bitmaps, so that freeing them doesn't change what is in the magazine first
+		uintptr_t freed[PAGE_MAGAZINE_SIZE];
+		page_alloc.alloc_bulk(PAGE_MAGAZINE_SIZE, freed);
+		
+		//the magazine fills up, then the next free drains the oldest batch to the bitmaps
+		uint32_t room = PAGE_MAGAZINE_SIZE - (PAGE_MAGAZINE_BATCH - 1);
+		for (uint32_t i = 0; i < room; i++){
+			page_alloc.ref_release(freed[i]);
+		}
+		all_passed &= page_alloc.get_magazine_stats().free_misses == magazines.free_misses;
+		
+		page_alloc.ref_release(freed[room]);
+		MagazineStats drained = page_alloc.get_magazine_stats();
+		all_passed &= drained.free_misses == magazines.free_misses + 1;
+		all_passed &= drained.cached_pages == magazines.cached_pages + room + 1 - PAGE_MAGAZINE_BATCH;
+		
+		//the last page freed is the first handed out again
+		uintptr_t again = page_alloc.alloc(1);
+		all_passed &= again == freed[room];
+		page_alloc.ref_release(again);
+		
+		for (uint32_t i = room + 1; i < PAGE_MAGAZINE_SIZE; i++){
+			page_alloc.ref_release(freed[i]);
+		}
+		for (uint32_t i = 0; i < num_taken; i++){
+			page_alloc.ref_release(taken[i]);
+		}
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Bulk allocation hands out whole blocks page by page: ");
+	{
+		MemStats stats = page_alloc.get_mem_stats();
+		MagazineStats magazines = page_alloc.get_magazine_stats();
+		
+		//a block of 16, one of 4 and a single page
+		const uint32_t count = 21;
+		uintptr_t pages[count];
+		page_alloc.alloc_bulk(count, pages);
+		
+		all_passed &= page_alloc.get_mem_stats().usedmem - stats.usedmem == count * PAGE_SIZE;
+		for (uint32_t i = 0; i < count; i++){
+			all_passed &= page_alloc.get_page_frame(pages[i]).refcount == 1;
+			for (uint32_t j = i + 1; j < count; j++){
+				all_passed &= pages[i] != pages[j];
+			}
+		}
+		
+		all_passed &= pages[0] % (16 * PAGE_SIZE) == 0 && pages[16] % (4 * PAGE_SIZE) == 0;
+		for (uint32_t i = 0; i < 16; i++){
+			all_passed &= pages[i] == pages[0] + i * PAGE_SIZE;
+		}
+		for (uint32_t i = 16; i < 20; i++){
+			all_passed &= pages[i] == pages[16] + (i - 16) * PAGE_SIZE;
+		}
+		
+		//the magazines are left alone, even for the single page
+		MagazineStats after = page_alloc.get_magazine_stats();
+		all_passed &= after.alloc_hits == magazines.alloc_hits && after.alloc_misses == magazines.alloc_misses;
+		all_passed &= after.cached_pages == magazines.cached_pages;
+		
+		for (uint32_t i = 0; i < count; i++){
+			page_alloc.ref_release_range(pages[i], 1);
+		}
+		all_passed &= same_free_blocks(stats, page_alloc.get_mem_stats());
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Magazines are flushed when memory runs out: ");
+	{
+		//room to note down every page there is
+		MemStats stats = page_alloc.get_mem_stats();
+		uint32_t list_pages = 1;
+		while (list_pages * PAGE_SIZE < stats.totalmem / PAGE_SIZE * sizeof(uintptr_t)){
+			list_pages <<= 1;
+		}
+		uintptr_t list = page_alloc.alloc(list_pages);
+		uintptr_t * pages = (uintptr_t*)list;
+		
+		//pages in the magazines and the zeroed pool count as free, so this only succeeds if they are given up
+		uint32_t free_pages = page_alloc.get_mem_stats().freemem / PAGE_SIZE;
+		page_alloc.alloc_bulk(free_pages, pages);
+		
+		all_passed &= page_alloc.get_mem_stats().freemem == 0;
+		all_passed &= page_alloc.get_magazine_stats().cached_pages == 0;
+		
+		for (uint32_t i = 0; i < free_pages; i++){
+			page_alloc.ref_release_range(pages[i], 1);
+		}
+		page_alloc.ref_release_range(list, list_pages);
+		
+		//put back what the loader started the kernel with
+		page_alloc.refill_zeroed_pool(ZEROED_POOL_TARGET);
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Zeroed pool hands out zeroed pages: ");
+	{
+		//empty the pool, dirtying each page before it is freed so that anything handed out unzeroed shows up
+		uintptr_t pages[ZEROED_POOL_TARGET];
+		for (uint32_t i = 0; i < ZEROED_POOL_TARGET; i++){
+			pages[i] = page_alloc.alloc_zeroed(1);
+			all_passed &= is_zeroed(pages[i], 1);
+		}
+		for (uint32_t i = 0; i < ZEROED_POOL_TARGET; i++){
+			memset(pages[i], 0xa5, PAGE_SIZE);
+			page_alloc.ref_release(pages[i]);
+		}
+		
+		//freeing doesn't refill the pool; only an explicit refill does
+		all_passed &= page_alloc.refill_zeroed_pool() == ZEROED_POOL_TARGET;
+		all_passed &= page_alloc.refill_zeroed_pool() == 0;
+		
+		for (uint32_t i = 0; i < ZEROED_POOL_TARGET; i++){
+			pages[i] = page_alloc.alloc_zeroed(1);
+			all_passed &= is_zeroed(pages[i], 1);
+		}
+		
+		//blocks of more than a page never come from the pool, so are zeroed inline
+		uintptr_t block = page_alloc.alloc(4);
+		memset(block, 0xa5, 4 * PAGE_SIZE);
+		page_alloc.ref_release_range(block, 4);
+		block = page_alloc.alloc_zeroed(4);
+		all_passed &= is_zeroed(block, 4);
+		page_alloc.ref_release_range(block, 4);
+		
+		for (uint32_t i = 0; i < ZEROED_POOL_TARGET; i++){
+			page_alloc.ref_release(pages[i]);
+		}
+		page_alloc.refill_zeroed_pool();
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_putline();
+	
+	MemStats stats_f = page_alloc.get_mem_stats();
+	
+	if (stats_i.usedmem != stats_f.usedmem){
+		uart_puts("Leaked ");
+		uart_puthex(stats_f.usedmem - stats_i.usedmem);
+		uart_puts(" bytes\r\n");
+		all_passed = false;
+	}
+	
+	return all_passed;
+}
@@ -1,6 +1,10 @@
 #include "pagetable.h"
+#include "bitmap.h"
+#include "cpu.h"
 #include "panic.h"
+#include "reverse_map.h"
 #include "uart.h"
+#include "tlb.h"
 
 #include <atomic>
 #include <algorithm>
@@ -23,12 +27,92 @@ static uint32_t get_allocation_pages(AllocationGranularity granularity){
 // 0 = page is not reserved
 // 1 = page is reserved
 
-PageTable::PageTable(PageAlloc &_page_alloc, bool is_supervisor, bool is_reference_counted) :
-	page_alloc(_page_alloc)
+static inline uint32_t index_bit(uint32_t index){
+	return 0x80000000 >> (index & 31);
+}
+
+//the first set bit in [first, end), or BITMAP_NOT_FOUND
+static uint32_t find_set_bit(const uint32_t * bitmap, uint32_t first, uint32_t end){
+	while (first < end){
+		uint32_t word = bitmap[first / 32] & (0xffffffff >> (first % 32));
+		
+		if (word != 0){
+			uint32_t index = (first & ~31) + __builtin_clz(word);
+			return (index < end) ? index : BITMAP_NOT_FOUND;
+		}
+		first = (first & ~31) + 32;
+	}
+	
+	return BITMAP_NOT_FOUND;
+}
+
+//the start of the first run of count set bits in [first, end), or BITMAP_NOT_FOUND; a word at a time
+static uint32_t find_set_run(const uint32_t * bitmap, uint32_t first, uint32_t end, uint32_t count){
+	uint32_t run_start = first;
+	uint32_t run = 0;
+	
+	for (uint32_t i = first; i < end;){
+		uint32_t word = bitmap[i / 32] << (i % 32);
+		uint32_t bits = std::min(32 - i % 32, end - i);
+		
+		//set bits carry the run on, up to the first clear one
+		uint32_t ones = std::min((word == 0xffffffff) ? 32 : (uint32_t)__builtin_clz(~word), bits);
+		if (ones > 0){
+			if (run == 0){
+				run_start = i;
+			}
+			run += ones;
+			if (run >= count){
+				return run_start;
+			}
+		}
+		
+		if (ones < bits){
+			//then skip the clear bits after it
+			uint32_t rest = word << ones;
+			uint32_t zeros = std::min((rest == 0) ? 32 : (uint32_t)__builtin_clz(rest), bits - ones);
+			
+			run = 0;
+			i += ones + zeros;
+		} else {
+			i += ones;
+		}
+	}
+	
+	return BITMAP_NOT_FOUND;
+}
+
+static inline uint32_t get_run_class(uint32_t run){
+	return 31 - __builtin_clz(run);
+}
+
+void PageTableFreeIndex::init(uint32_t * bitmaps, uint8_t * runs, uint32_t num_entries){
+	free_sections = bitmaps;
+	bitmaps += num_entries / 32;
+	for (uint32_t run_class = 0; run_class < SECOND_LEVEL_RUN_CLASSES; run_class++){
+		tables_by_run[run_class] = bitmaps;
+		bitmaps += num_entries / 32;
+	}
+	free_supersections = bitmaps;
+	longest_run = runs;
+}
+
+//the top run class only holds tables with every page free, a run that doesn't fit in a byte
+uint32_t PageTableFreeIndex::get_longest_run(uint32_t index){
+	return (tables_by_run[SECOND_LEVEL_RUN_CLASSES - 1][index / 32] & index_bit(index)) ? SECOND_LEVEL_ENTRIES : longest_run[index];
+}
+
+PageTable::PageTable(PageAlloc &_page_alloc, bool is_supervisor, bool is_reference_counted, ReverseMap * _reverse_map) :
+	free_second_level_tables(nullptr), reverse_map(_reverse_map), page_alloc(_page_alloc)
 {
-	first_level_table = (uint32_t*)page_alloc.alloc(4); //4 pages for both modes
+	first_level_table = (uint32_t*)page_alloc.alloc_zeroed(4); //4 pages for both modes, all entries start free
+	page_alloc.set_page_flags((uintptr_t)first_level_table, 4, PAGE_FRAME_PAGE_TABLE);
 	
 	reference_counted = is_reference_counted;
+	if (reference_counted){
+		//only allocate() gives a table pages that nothing else refers to
+		page_alloc.add_movable_table(this);
+	}
 	
 	if (is_supervisor){
 		//supervisor (4k entries)
@@ -38,9 +122,14 @@ PageTable::PageTable(PageAlloc &_page_alloc, bool is_supervisor, bool is_referen
 		first_level_num_entries = FIRST_LEVEL_USER_ENTRIES;
 	}
 	
-	for (uint32_t i = 0; i < first_level_num_entries; i++){
-		first_level_table[i] = 0x00000000;
+	if (first_level_num_entries == FIRST_LEVEL_USER_ENTRIES){
+		uint32_t * bitmaps = first_level_table + FIRST_LEVEL_USER_ENTRIES;
+		free_index.init(bitmaps, (uint8_t*)(bitmaps + PageTableFreeIndex::get_bitmap_words(first_level_num_entries)), first_level_num_entries);
+	} else {
+		uint32_t * bitmaps = (uint32_t*)page_alloc.alloc_zeroed(PAGE_TABLE_FREE_INDEX_BITMAP_PAGES);
+		free_index.init(bitmaps, (uint8_t*)page_alloc.alloc_zeroed(PAGE_TABLE_FREE_INDEX_RUN_PAGES), first_level_num_entries);
 	}
+	index_sections(0, first_level_num_entries, true);
 	
 	//allocate the page at 0x00000000 to catch null dereferences
 	/*auto reservation = reserve(0x00000000, 1, AllocationGranularity::Page);
@@ -53,19 +142,102 @@ PageTable::PageTable(PageAlloc &_page_alloc, bool is_supervisor, bool is_referen
 	}*/
 }
 
+void PageTable::push_free_second_level_table(FreeSecondLevelTable * table){
+	table->prev = nullptr;
+	table->next = free_second_level_tables;
+	if (free_second_level_tables != nullptr){
+		free_second_level_tables->prev = table;
+	}
+	free_second_level_tables = table;
+}
+
+void PageTable::remove_free_second_level_table(FreeSecondLevelTable * table){
+	if (table->prev != nullptr){
+		table->prev->next = table->next;
+	} else {
+		free_second_level_tables = table->next;
+	}
+	if (table->next != nullptr){
+		table->next->prev = table->prev;
+	}
+}
+
 uint32_t * PageTable::create_second_level_table() {
-	uint32_t * second_level_table = (uint32_t*)page_alloc.alloc(1); //4 times as much space as we need...
+	uint32_t * second_level_table;
 	
-	for (uint32_t i = 0; i < SECOND_LEVEL_ENTRIES; i++) {
-		second_level_table[i] = 0x00000000;
+	if (free_second_level_tables != nullptr){
+		FreeSecondLevelTable * table = free_second_level_tables;
+		remove_free_second_level_table(table);
+		page_alloc.ref_acquire((uintptr_t)table & ~(PAGE_SIZE - 1));
+		
+		//a free quarter is zeroed apart from its links: new pages come zeroed, and a table is only freed once every
+		//entry in it has been released
+		table->prev = nullptr;
+		table->next = nullptr;
+		
+		second_level_table = (uint32_t*)table;
+	} else {
+		//a new page: the first quarter is handed out, and the rest wait on the free list
+		uintptr_t page = page_alloc.alloc_zeroed(1);
+		page_alloc.set_page_flags(page, 1, PAGE_FRAME_PAGE_TABLE);
+		
+		for (uint32_t i = SECOND_LEVEL_TABLES_PER_PAGE; i-- > 1;){
+			push_free_second_level_table((FreeSecondLevelTable*)(page + i * SECOND_LEVEL_TABLE_SIZE));
+		}
+		
+		second_level_table = (uint32_t*)page;
 	}
 	
 	return second_level_table;
 }
 
+void PageTable::free_second_level_table(uint32_t * table) {
+	uintptr_t page = (uintptr_t)table & ~(PAGE_SIZE - 1);
+	
+	if (page_alloc.get_page_frame(page).refcount == 1){
+		//the page's last table, so its other quarters are all on the free list, and go back to PageAlloc with it
+		for (uint32_t i = 0; i < SECOND_LEVEL_TABLES_PER_PAGE; i++){
+			uintptr_t quarter = page + i * SECOND_LEVEL_TABLE_SIZE;
+			
+			if (quarter != (uintptr_t)table){
+				remove_free_second_level_table((FreeSecondLevelTable*)quarter);
+			}
+		}
+	} else {
+		push_free_second_level_table((FreeSecondLevelTable*)table);
+	}
+	
+	page_alloc.ref_release(page);
+}
+
 PageTable::~PageTable() {
-	//release every page that has been allocated
+	if (reference_counted){
+		page_alloc.remove_movable_table(this);
+	}
+	
+	//the table may have been active at some point, and its global entries outlive switching to another one, so whatever
+	//it mapped is invalidated before the pages go
 	uint32_t* first_level_table = get_first_level_table_address();
+	TlbBatch tlb;
+	
+	for (uint32_t i = 0; i < first_level_num_entries; i++){
+		uint32_t first_level_entry = first_level_table[i];
+		
+		if ((first_level_entry & 0x3) == 0x1){
+			uint32_t * second_level_table = get_second_level_table_address(first_level_entry & 0xfffffc00);
+			
+			for (uint32_t j = 0; j < SECOND_LEVEL_ENTRIES; j++){
+				if (second_level_table[j] & 0x2){
+					tlb.add((i << 20) | (j << 12));
+				}
+			}
+		} else if ((first_level_entry & 0x3) == 0x2 && (!(first_level_entry & 0x00040000) || i % 16 == 0)){
+			tlb.add(i << 20);
+		}
+	}
+	tlb.finish();
+	
+	//release every page that has been allocated
 	for (uint32_t i = 0; i < first_level_num_entries; i++){
 		uint32_t & first_level_entry = first_level_table[i];
 		
@@ -82,10 +254,14 @@ PageTable::~PageTable() {
 					if (reference_counted){
 						page_alloc.ref_release(physical_address);
 					}
+					if (reverse_map != nullptr){
+						reverse_map->remove(physical_address, this, (i << 20) | (j << 12));
+					}
 				}
 			}
 			
-			//free table - done even if the table isn't reference-counted
+			//free table - done even if the table isn't reference-counted; the free quarters hold no reference, so
+			//each page goes once its last table has
 			page_alloc.ref_release((uintptr_t)second_level_table);
 		} else if ((first_level_entry & 0x3) == 0x2){
 			uintptr_t physical_address;
@@ -98,33 +274,106 @@ PageTable::~PageTable() {
 			}
 			
 			if (reference_counted){
-				page_alloc.ref_release(physical_address, SECOND_LEVEL_ENTRIES);
+				page_alloc.ref_release_range(physical_address, SECOND_LEVEL_ENTRIES);
+			}
+			//a supersection is recorded once, for its first section
+			if (reverse_map != nullptr && (!(first_level_entry & 0x00040000) || i % 16 == 0)){
+				reverse_map->remove(physical_address, this, i << 20);
 			}
 		}
 	}
 	
-	uintptr_t page_base = (uintptr_t)first_level_table;
-	for (uint32_t i = 0; i < 4; i++){
-		page_alloc.ref_release(page_base + i * 0x1000); //decrement the reference counts on the four pages
+	page_alloc.ref_release_range((uintptr_t)first_level_table, 4); //decrement the reference counts on the four pages
+	if (first_level_num_entries != FIRST_LEVEL_USER_ENTRIES){
+		page_alloc.ref_release_range((uintptr_t)free_index.free_sections, PAGE_TABLE_FREE_INDEX_BITMAP_PAGES);
+		page_alloc.ref_release_range((uintptr_t)free_index.longest_run, PAGE_TABLE_FREE_INDEX_RUN_PAGES);
+	}
+}
+
+void PageTable::index_sections(uint32_t first_index, uint32_t count, bool free){
+	if (count == 0){
+		return;
+	}
+	
+	for (uint32_t i = first_index; i < first_index + count; i++){
+		if (free){
+			free_index.free_sections[i / 32] |= index_bit(i);
+		} else {
+			free_index.free_sections[i / 32] &= ~index_bit(i);
+		}
+	}
+	
+	//a group of 16 is half a word
+	for (uint32_t group = first_index / 16; group <= (first_index + count - 1) / 16; group++){
+		uint32_t sections = (free_index.free_sections[group / 2] >> ((group % 2) ? 0 : 16)) & 0xffff;
+		
+		if (sections == 0xffff){
+			free_index.free_supersections[group / 32] |= index_bit(group);
+		} else {
+			free_index.free_supersections[group / 32] &= ~index_bit(group);
+		}
+	}
+}
+
+void PageTable::index_second_level_table(uint32_t index){
+	uint32_t longest_run = free_index.get_longest_run(index);
+	
+	if (longest_run > 0){
+		free_index.tables_by_run[get_run_class(longest_run)][index / 32] &= ~index_bit(index);
+	}
+	longest_run = 0;
+	
+	uint32_t first_level_entry = get_first_level_table_address()[index];
+	if ((first_level_entry & 0x3) == 0x1){
+		uint32_t * second_level_table = get_second_level_table_address(first_level_entry & 0xfffffc00);
+		uint32_t run = 0;
+		
+		for (uint32_t j = 0; j < SECOND_LEVEL_ENTRIES; j++){
+			if ((second_level_table[j] & 0x7) == 0x0){
+				run++;
+				longest_run = std::max(longest_run, run);
+			} else {
+				run = 0;
+			}
+		}
+	}
+	
+	free_index.longest_run[index] = (uint8_t)longest_run;
+	if (longest_run > 0){
+		free_index.tables_by_run[get_run_class(longest_run)][index / 32] |= index_bit(index);
 	}
 }
 
 Result<uintptr_t> PageTable::reserve(uint32_t units, AllocationGranularity granularity){
+	return reserve_within(0, first_level_num_entries * SECTION_SIZE, units, granularity);
+}
+
+Result<uintptr_t> PageTable::reserve_within(uintptr_t start, uintptr_t end, uint32_t units, AllocationGranularity granularity){
+	//a whole number of sections; the end of a supervisor table's range wraps to 0
+	uint32_t first_index = (start + SECTION_SIZE - 1) >> 20;
+	uint32_t end_index = std::min((uint32_t)((end - 1) >> 20) + 1, first_level_num_entries);
+	
+	if (first_index >= end_index){
+		return Result<uintptr_t>::failure();
+	}
+	
+	InterruptGuard guard;
 	auto lock = spinlock_cs.acquire();
 	
 	switch (granularity){
 		case AllocationGranularity::Page:
-			return reserve_pages(units);
+			return reserve_pages(units, first_index, end_index);
 		case AllocationGranularity::Section:
-			return reserve_sections(units);
+			return reserve_sections(units, first_index, end_index);
 		case AllocationGranularity::Supersection:
-			return reserve_supersections(units);
+			return reserve_supersections(units, first_index, end_index);
 		default:
 			panic(PanicCodes::IncompatibleParameter);
 	}
 }
 
 Result<uintptr_t> PageTable::reserve(uintptr_t address, uint32_t units, AllocationGranularity granularity){
+	InterruptGuard guard;
 	auto lock = spinlock_cs.acquire();
 	
 	switch (granularity){
@@ -150,16 +399,18 @@ bool PageTable::allocate(uintptr_t virtual_address, uint32_t units, AllocationGr
 	uart_putdec((uint32_t)granularity);
 	uart_puts(")\r\n");
 #endif
-	
+
 	if (!reference_counted){
 		panic(PanicCodes::AllocationInNonReferenceCountedTable);
 	}
 	
-	auto lock = spinlock_cs.acquire();
-	
 	for (uint32_t i = 0; i < units; i++){
-		//allocate a block
-		uintptr_t physical_address = page_alloc.alloc(get_allocation_pages(granularity));
+		//allocate a block; it is only reachable through this table, so it could be moved
+		//the lock isn't held yet, so that compaction can move this table's pages to make room
+		uintptr_t physical_address = page_alloc.alloc(get_allocation_pages(granularity), PageMobility::Movable);
+		
+		InterruptGuard guard;
+		auto lock = spinlock_cs.acquire();
 		
 		uintptr_t map_address = virtual_address + i * get_allocation_pages(granularity) * PAGE_SIZE;
 		
@@ -185,16 +436,19 @@ bool PageTable::allocate(uintptr_t virtual_address, uint32_t units, AllocationGr
 		}
 		
 		if (!success) {
-			page_alloc.ref_release(physical_address, get_allocation_pages(granularity)); //free the allocated memory
+			page_alloc.ref_release_range(physical_address, get_allocation_pages(granularity)); //free the allocated memory
+			tlb_sync();
 			return false;
 		}
 	}
 	
+	tlb_sync();
 	return true;
 }
 
 //TODO: cleanup on partial failure
 bool PageTable::map(uintptr_t virtual_address, uintptr_t physical_address, uint32_t units, AllocationGranularity granularity) {
+	InterruptGuard guard;
 	auto lock = spinlock_cs.acquire();
 	
 	for (uint32_t i = 0; i < units; i++){
@@ -217,17 +471,159 @@ bool PageTable::map(uintptr_t virtual_address, uintptr_t physical_address, uint3
 				panic(PanicCodes::IncompatibleParameter);
 		}
 		
-		if (!success) return false;
+		if (!success){
+			tlb_sync();
+			return false;
+		}
 	}
 	
 	if (reference_counted){
 		//bump reference counts
-		page_alloc.ref_acquire(physical_address, units * get_allocation_pages(granularity));
+		page_alloc.ref_acquire_range(physical_address, units * get_allocation_pages(granularity));
+	}
+	
+	tlb_sync();
+	return true;
+}
+
+bool PageTable::decommit(uintptr_t virtual_address, uint32_t units, AllocationGranularity granularity){
+	return uncommit(virtual_address, units, granularity, false);
+}
+
+bool PageTable::release(uintptr_t virtual_address, uint32_t units, AllocationGranularity granularity){
+	return uncommit(virtual_address, units, granularity, true);
+}
+
+bool PageTable::uncommit(uintptr_t virtual_address, uint32_t units, AllocationGranularity granularity, bool release_reservation){
+	uint32_t unit_pages = get_allocation_pages(granularity);
+	uint32_t unit_size = unit_pages * PAGE_SIZE;
+	uint32_t descriptors_per_unit = (granularity == AllocationGranularity::Supersection) ? 16 : 1;
+	
+	virtual_address &= ~(unit_size - 1);
+	
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	//check every unit before changing any of them
+	for (uint32_t i = 0; i < units; i++){
+		uintptr_t unit_address = virtual_address + i * unit_size;
+		
+		auto result = (granularity == AllocationGranularity::Page) ? get_page_descriptor(unit_address) : get_section_descriptor(unit_address, false);
+		if (!result.is_success){
+			return false;
+		}
+		
+		for (uint32_t j = 0; j < descriptors_per_unit; j++){
+			uint32_t descriptor = result.value[j];
+			
+			if ((descriptor & 0x7) == 0x4){
+				//reserved, which decommit leaves alone
+				continue;
+			}
+			
+			bool committed;
+			switch (granularity){
+				case AllocationGranularity::Page:
+					committed = descriptor & 0x2;
+					break;
+				case AllocationGranularity::Section:
+					committed = (descriptor & 0x3) == 0x2 && !(descriptor & 0x00040000);
+					break;
+				default:
+					committed = (descriptor & 0x3) == 0x2 && (descriptor & 0x00040000);
+					break;
+			}
+			
+			if (!committed){
+				return false;
+			}
+		}
+	}
+	
+	//the pages are only handed back once the TLB has forgotten them, so the committed descriptors are first made faults
+	//that still hold their address (reserved ones are exactly 0x4, which a fault made from a committed one never is)
+	for (uint32_t i = 0; i < units; i++){
+		uintptr_t unit_address = virtual_address + i * unit_size;
+		
+		uint32_t * descriptor = ((granularity == AllocationGranularity::Page) ? get_page_descriptor(unit_address) : get_section_descriptor(unit_address, false)).value;
+		
+		if ((*descriptor & 0x7) != 0x4){
+			if (reverse_map != nullptr){
+				reverse_map->remove(*descriptor & ~(unit_size - 1), this, unit_address);
+			}
+			
+			for (uint32_t j = 0; j < descriptors_per_unit; j++){
+				descriptor[j] &= ~0x3;
+			}
+		}
+	}
+	
+	tlb_invalidate_range(virtual_address, units, unit_size);
+	
+	uintptr_t run_start = 0;
+	uint32_t run_pages = 0;
+	
+	for (uint32_t i = 0; i < units; i++){
+		uintptr_t unit_address = virtual_address + i * unit_size;
+		
+		uint32_t * descriptor = ((granularity == AllocationGranularity::Page) ? get_page_descriptor(unit_address) : get_section_descriptor(unit_address, false)).value;
+		
+		if (*descriptor != 0x00000004 && reference_counted){
+			uintptr_t physical_address = *descriptor & ~(unit_size - 1);
+			
+			if (run_pages > 0 && physical_address == run_start + run_pages * PAGE_SIZE){
+				run_pages += unit_pages;
+			} else {
+				if (run_pages > 0){
+					page_alloc.ref_release_range(run_start, run_pages);
+				}
+				run_start = physical_address;
+				run_pages = unit_pages;
+			}
+		}
+		
+		for (uint32_t j = 0; j < descriptors_per_unit; j++){
+			descriptor[j] = release_reservation ? 0x00000000 : 0x00000004;
+		}
+	}
+	
+	if (run_pages > 0){
+		page_alloc.ref_release_range(run_start, run_pages);
+	}
+	
+	if (release_reservation && granularity == AllocationGranularity::Page && units > 0){
+		free_empty_second_level_tables(virtual_address >> 20, ((virtual_address + (units - 1) * unit_size) >> 20) + 1);
+	} else if (release_reservation){
+		index_sections(virtual_address >> 20, units * descriptors_per_unit, true);
 	}
 	
 	return true;
 }
 
+//the lock must be held; a second-level table with nothing reserved in it is only taking up a page
+//the tables are reindexed on the way, since their pages have just been released
+void PageTable::free_empty_second_level_tables(uint32_t first_index, uint32_t end_index){
+	uint32_t * first_level_table = get_first_level_table_address();
+	
+	for (uint32_t i = first_index; i < end_index; i++){
+		uint32_t & first_level_entry = first_level_table[i];
+		
+		if ((first_level_entry & 0x3) != 0x1){
+			continue;
+		}
+		
+		index_second_level_table(i);
+		
+		if (free_index.get_longest_run(i) == SECOND_LEVEL_ENTRIES){
+			free_second_level_table(get_second_level_table_address(first_level_entry & 0xfffffc00));
+			first_level_entry = 0x00000000;
+			
+			index_second_level_table(i);
+			index_sections(i, 1, true);
+		}
+	}
+}
+
 Result<uintptr_t> PageTable::reserve_allocate(uint32_t units, AllocationGranularity granularity){
 	//doesn't acquire lock; convenience method
 	
@@ -264,6 +660,9 @@ bool PageTable::commit_page(uintptr_t virtual_address, uintptr_t physical_addres
 		if ((*result.value & 0x7) == 0x4){
 			//reserved but not committed yet
 			*result.value = physical_address | 0x00000002;
+			if (reverse_map != nullptr){
+				reverse_map->add(physical_address, this, virtual_address, AllocationGranularity::Page);
+			}
 			return true;
 		}
 	}
@@ -282,6 +681,9 @@ bool PageTable::commit_section(uintptr_t virtual_address, uintptr_t physical_add
 		if ((*result.value & 0x7) == 0x4){
 			//reserved but not committed yet
 			*result.value = physical_address | 0x00000002;
+			if (reverse_map != nullptr){
+				reverse_map->add(physical_address, this, virtual_address, AllocationGranularity::Section);
+			}
 			return true;
 		}
 	}
@@ -296,7 +698,7 @@ bool PageTable::commit_supersection(uintptr_t virtual_address, uintptr_t physica
 	uart_puthex(physical_address);
 	uart_puts(")\r\n");
 #endif
-	
+
 	//TODO: Permission bits
 	virtual_address &= 0xff000000;
 	physical_address &= 0xff000000;
@@ -311,6 +713,9 @@ bool PageTable::commit_supersection(uintptr_t virtual_address, uintptr_t physica
 		for (uint32_t i = 0; i < 16; i++){
 			result.value[i] = physical_address | 0x00040002;
 		}
+		if (reverse_map != nullptr){
+			reverse_map->add(physical_address, this, virtual_address, AllocationGranularity::Supersection);
+		}
 		return true;
 	}
 	return false;
@@ -328,7 +733,7 @@ Result<uint32_t*> PageTable::get_page_descriptor(uintptr_t virtual_address) {
 	if ((first_level_entry & 0x3) == 1) {
 		uint32_t * second_level_table = get_second_level_table_address(first_level_entry & 0xfffffc00);
 		uint32_t second_level_index = (virtual_address >> 12) & 0xff;
-	
+		
 		return Result<uint32_t*>::success(&second_level_table[second_level_index]);
 	}
 	
@@ -351,126 +756,112 @@ Result<uint32_t*> PageTable::get_section_descriptor(uintptr_t virtual_address, b
 	}
 }
 
-Result<uintptr_t> PageTable::reserve_pages(uint32_t num_pages){
+Result<uintptr_t> PageTable::reserve_pages(uint32_t num_pages, uint32_t first_index, uint32_t end_index){
 	uint32_t * first_level_table = get_first_level_table_address();
 	
-	//trawl through all the second-level page tables looking for a space
-	for (uint32_t i = 0; i < first_level_num_entries; i++){
-		uint32_t contiguous_free_pages = 0;
+	if (num_pages > SECOND_LEVEL_ENTRIES){
+		//too many for one second-level table, so start the pages on a run of free sections and reserve them by address
+		uint32_t num_sections = (num_pages + SECOND_LEVEL_ENTRIES - 1) / SECOND_LEVEL_ENTRIES;
+		uint32_t start_index = find_set_run(free_index.free_sections, first_index, end_index, num_sections);
 		
-		uint32_t & first_level_entry = first_level_table[i];
-		if ((first_level_entry & 0x3) == 1){
-			//it's a second-level table
-			//see if there are any empty slots
+		if (start_index == BITMAP_NOT_FOUND){
+			return Result<uintptr_t>::failure();
+		}
+		
+		return reserve_pages(start_index * SECTION_SIZE, num_pages);
+	}
+	
+	//tables whose longest run is in num_pages's class may or may not have room; any in a class above it do, so the
+	//first of those will do
+	for (uint32_t run_class = get_run_class(num_pages); run_class < SECOND_LEVEL_RUN_CLASSES; run_class++){
+		const uint32_t * tables = free_index.tables_by_run[run_class];
+		
+		for (uint32_t i = find_set_bit(tables, first_index, end_index); i != BITMAP_NOT_FOUND; i = find_set_bit(tables, i + 1, end_index)){
+			if (free_index.get_longest_run(i) < num_pages){
+				continue;
+			}
+			
+			uint32_t * second_level_table = get_second_level_table_address(first_level_table[i] & 0xfffffc00);
+			uint32_t contiguous_free_pages = 0;
 			
-			uint32_t * second_level_table = get_second_level_table_address(first_level_entry & 0xfffffc00);
 			for (uint32_t j = 0; j < SECOND_LEVEL_ENTRIES; j++){
-				uint32_t & second_level_entry = second_level_table[j];
-				
-				if ((second_level_entry & 0x7) == 0x0){
-					//this page is usable
+				if ((second_level_table[j] & 0x7) == 0x0){
 					contiguous_free_pages++;
 				} else {
 					contiguous_free_pages = 0;
 				}
 				
 				if (contiguous_free_pages == num_pages){
-					//we have enough contiguous pages in this second-level table to complete the reservation
 					uint32_t start_index = j - num_pages + 1;
 					for (uint32_t k = start_index; k < start_index + num_pages; k++) {
 						second_level_table[k] = 0x00000004; //mark as reserved
 					}
+					index_second_level_table(i);
 					
 					return Result<uintptr_t>::success(i * SECTION_SIZE + start_index * PAGE_SIZE);
 				}
 			}
+			
+			//the index said there was room
+			panic(PanicCodes::AssertionFailure);
 		}
 	}
 	
-	//if we get here, there were no free pages
-	//create a new second-level table
-	for (uint32_t i = 0; i < first_level_num_entries; i++){
-		uint32_t & first_level_entry = first_level_table[i];
-		if ((first_level_entry & 0x7) == 0x0){
-			//it's an unreserved free section
-			
-			//TODO: fix this
-			uint32_t * second_level_table = get_second_level_table_address((uint32_t)create_second_level_table());
-			first_level_table[i] = (uint32_t)second_level_table | 0x1 | (SUPERVISOR_DOMAIN << 5);
-			
-			for (uint32_t j = 0; j < num_pages; j++){
-				second_level_table[j] = 0x00000004;
-			}
-			
-			return Result<uintptr_t>::success(i * SECTION_SIZE);
-		}
+	//no second-level table has room, so create a new one in the first free section
+	uint32_t i = find_set_bit(free_index.free_sections, first_index, end_index);
+	if (i == BITMAP_NOT_FOUND){
+		//we have insufficient address space left (i.e. it's all been reserved (or allocated... ^_^))
+		return Result<uintptr_t>::failure();
 	}
 	
-	//if we get here, we have insufficient address space left (i.e. it's all been reserved (or allocated... ^_^))
-	return Result<uintptr_t>::failure();
+	//TODO: fix this
+	uint32_t * second_level_table = get_second_level_table_address((uintptr_t)create_second_level_table());
+	first_level_table[i] = (uintptr_t)second_level_table | 0x1 | (SUPERVISOR_DOMAIN << 5);
+	
+	for (uint32_t j = 0; j < num_pages; j++){
+		second_level_table[j] = 0x00000004;
+	}
+	
+	index_sections(i, 1, false);
+	index_second_level_table(i);
+	
+	return Result<uintptr_t>::success(i * SECTION_SIZE);
 }
 
-Result<uintptr_t> PageTable::reserve_sections(uint32_t num_sections) {
+Result<uintptr_t> PageTable::reserve_sections(uint32_t num_sections, uint32_t first_index, uint32_t end_index) {
 	uint32_t * first_level_table = get_first_level_table_address();
 	
-	uint32_t contiguous_free_sections = 0;
+	uint32_t start_index = find_set_run(free_index.free_sections, first_index, end_index, num_sections);
+	if (start_index == BITMAP_NOT_FOUND){
+		//we have insufficient address space left (i.e. it's all been reserved (or allocated... ^_^))
+		return Result<uintptr_t>::failure();
+	}
 	
-	for (uint32_t i = 0; i < first_level_num_entries; i++){
-		uint32_t & first_level_entry = first_level_table[i];
-		if ((first_level_entry & 0x7) == 0x0){
-			//it's an unreserved free section
-			contiguous_free_sections++;
-		} else {
-			contiguous_free_sections = 0;
-		}
-		
-		if (contiguous_free_sections == num_sections){
-			uint32_t start_index = i - num_sections + 1;
-			
-			for (uint32_t j = start_index; j < start_index + num_sections; j++){
-				first_level_table[j] = 0x00000004;
-			}
-			
-			return Result<uintptr_t>::success(start_index * SECTION_SIZE);
-		}
+	for (uint32_t j = start_index; j < start_index + num_sections; j++){
+		first_level_table[j] = 0x00000004;
 	}
+	index_sections(start_index, num_sections, false);
 	
-	//if we get here, we have insufficient address space left (i.e. it's all been reserved (or allocated... ^_^))
-	return Result<uintptr_t>::failure();
+	return Result<uintptr_t>::success(start_index * SECTION_SIZE);
 }
 
-Result<uintptr_t> PageTable::reserve_supersections(uint32_t num_supersections) {
+Result<uintptr_t> PageTable::reserve_supersections(uint32_t num_supersections, uint32_t first_index, uint32_t end_index) {
 	uint32_t * first_level_table = get_first_level_table_address();
 	
-	uint32_t contiguous_free_supersections = 0;
+	//supersections are aligned to 16 sections
+	uint32_t group = find_set_run(free_index.free_supersections, (first_index + 15) / 16, end_index / 16, num_supersections);
+	if (group == BITMAP_NOT_FOUND){
+		//we have no address space left (i.e. it's all been reserved (or allocated... ^_^))
+		return Result<uintptr_t>::failure();
+	}
 	
-	for (uint32_t i = 0; i < first_level_num_entries; i += 16){
-		bool all_sections_free = true;
-		for (uint32_t j = 0; j < 16; j++){
-			uint32_t & first_level_entry = first_level_table[i+j];
-			all_sections_free &= ((first_level_entry & 0x7) == 0x0);
-		}
-		if (all_sections_free){
-			//we have 16 consecutive free sections
-			contiguous_free_supersections++;
-		} else {
-			contiguous_free_supersections = 0;
-		}
-		
-		if (contiguous_free_supersections == num_supersections){
-			uint32_t start_index = i - 16 * (num_supersections - 1);
-			for (uint32_t k = start_index; k < start_index + (num_supersections * 16); k += 16){
-				for (uint32_t j = 0; j < 16; j++){
-					first_level_table[k+j] = 0x00000004;
-				}
-			}
-			
-			return Result<uintptr_t>::success(start_index * SECTION_SIZE);
-		}
+	uint32_t start_index = group * 16;
+	for (uint32_t j = start_index; j < start_index + num_supersections * 16; j++){
+		first_level_table[j] = 0x00000004;
 	}
+	index_sections(start_index, num_supersections * 16, false);
 	
-	//if we get here, we have no address space left (i.e. it's all been reserved (or allocated... ^_^))
-	return Result<uintptr_t>::failure();
+	return Result<uintptr_t>::success(start_index * SECTION_SIZE);
 }
 
 Result<uintptr_t> PageTable::reserve_pages(uintptr_t base, uint32_t num_pages) {
@@ -542,8 +933,10 @@ void PageTable::reserve_pages_from_section(uintptr_t base, uint32_t num_pages) {
 		//create new second-level table
 		//TODO: fix this
 		uint32_t * new_table = create_second_level_table();
-		*result.value = (uint32_t)new_table | 0x1 | (SUPERVISOR_DOMAIN << 5);
+		*result.value = (uintptr_t)new_table | 0x1 | (SUPERVISOR_DOMAIN << 5);
 		second_level_table = get_second_level_table_address((uintptr_t)new_table);
+		
+		index_sections(base >> 20, 1, false);
 	} else {
 		second_level_table = get_second_level_table_address(*result.value & 0xfffffc00);
 	}
@@ -553,6 +946,7 @@ void PageTable::reserve_pages_from_section(uintptr_t base, uint32_t num_pages) {
 	for (uint32_t i = 0; i < num_pages; i++){
 		second_level_table[start_index + i] = 0x00000004;
 	}
+	index_second_level_table(base >> 20);
 }
 
 Result<uintptr_t> PageTable::reserve_sections(uintptr_t base, uint32_t num_sections) {
@@ -569,6 +963,7 @@ Result<uintptr_t> PageTable::reserve_sections(uintptr_t base, uint32_t num_secti
 		auto result = get_section_descriptor(base + i * SECTION_SIZE, false);
 		*result.value = 0x00000004;
 	}
+	index_sections(base >> 20, num_sections, false);
 	
 	return Result<uintptr_t>::success(base);
 }
@@ -587,25 +982,13 @@ Result<uintptr_t> PageTable::reserve_supersections(uintptr_t base, uint32_t num_
 		auto result = get_section_descriptor(base + i * SECTION_SIZE, false);
 		*result.value = 0x00000004;
 	}
+	index_sections(base >> 20, num_supersections * 16, false);
 	
 	return Result<uintptr_t>::success(base);
 }
 
 Result<uintptr_t> PageTable::virtual_to_physical_internal(uintptr_t virtual_address) {
-	//apparently this can be done in hardware
-	//http://blogs.bu.edu/md/2011/12/06/tagged-tlbs-and-context-switching/
-	
-	/*uint32_t pa;
-	asm volatile ("mcr p15, 0, %[va], c7, c8, 0" : : [va] "r" (virtual_address));
-	asm volatile ("mrc p15, 0, %[pa], c7, c4, 0" : [pa] "=r" (pa));
-	
-	if (pa & 0x00000001){
-		//abort
-		return Result<uintptr_t>::failure();
-	} else {
-		//success
-		return Result<uintptr_t>::success(pa & 0xfffffc00);
-	}*/
+	//the MMU can do this for the tables it is walking (see virtual_to_physical); any other table is walked here
 	
 	//see if the address is mapped
 	uint32_t first_level_index = virtual_address >> 20;
@@ -654,7 +1037,7 @@ Result<uintptr_t> PageTable::virtual_to_physical_internal(uintptr_t virtual_addr
 }
 
 Result<uintptr_t> PageTable::physical_to_virtual_internal(uintptr_t physical_address) {
-	//very slow, avoid if possible
+	//very slow, avoid if possible (a table with a ReverseMap only comes here for addresses outside RAM)
 	//requires iterating through all the first- and second-level page table entries
 	//returns only the first virtual mapping that matches the target
 	uint32_t * first_level_table = get_first_level_table_address();
@@ -675,7 +1058,7 @@ Result<uintptr_t> PageTable::physical_to_virtual_internal(uintptr_t physical_add
 							//page is committed
 							if ((second_level_entry & 0xfffff000) == (physical_address & 0xfffff000)){
 								//match
-								uintptr_t address = (first_level_entry & 0xfffff000) | (physical_address & 0x00000fff);
+								uintptr_t address = (i << 20) | (j << 12) | (physical_address & 0x00000fff);
 								return Result<uintptr_t>::success(address);
 							}
 						}
@@ -688,14 +1071,14 @@ Result<uintptr_t> PageTable::physical_to_virtual_internal(uintptr_t physical_add
 					//supersection
 					if ((first_level_entry & 0xff000000) == (physical_address & 0xff000000)){
 						//match
-						uintptr_t address = (first_level_entry & 0xff000000) | (physical_address & 0x00ffffff);
+						uintptr_t address = ((i << 20) & 0xff000000) | (physical_address & 0x00ffffff);
 						return Result<uintptr_t>::success(address);
 					}
 				} else {
 					//regular section
 					if ((first_level_entry & 0xfff00000) == (physical_address & 0xfff00000)){
 						//match
-						uintptr_t address = (first_level_entry & 0xfff00000) | (physical_address & 0x000fffff);
+						uintptr_t address = (i << 20) | (physical_address & 0x000fffff);
 						return Result<uintptr_t>::success(address);
 					}
 				}
@@ -709,6 +1092,53 @@ Result<uintptr_t> PageTable::physical_to_virtual_internal(uintptr_t physical_add
 	return Result<uintptr_t>::failure();
 }
 
+//called by PageAlloc::compact, which holds its own lock, for every reference-counted table
+//repoints each 4KiB page this table maps in [start, end) at the copy page_alloc makes of it
+void PageTable::migrate_pages(uintptr_t start, uintptr_t end){
+	//if the table is locked further up this call chain (a commit allocating a second-level table), its pages just stay where they are
+	auto lock = spinlock_cs.try_acquire();
+	if (!lock){
+		return;
+	}
+	
+	//the old pages aren't reused until every table has been through, so the TLB is only invalidated at the end
+	TlbBatch tlb;
+	
+	uint32_t * first_level_table = get_first_level_table_address();
+	for (uint32_t i = 0; i < first_level_num_entries; i++){
+		uint32_t first_level_entry = first_level_table[i];
+		
+		if ((first_level_entry & 0x3) != 0x1){
+			continue;
+		}
+		
+		uint32_t * second_level_table = get_second_level_table_address(first_level_entry & 0xfffffc00);
+		
+		for (uint32_t j = 0; j < SECOND_LEVEL_ENTRIES; j++){
+			uint32_t & second_level_entry = second_level_table[j];
+			
+			if (second_level_entry & 0x2){
+				uintptr_t physical_address = second_level_entry & 0xfffff000;
+				
+				if (physical_address >= start && physical_address < end){
+					uintptr_t new_physical_address = page_alloc.migrate_page(physical_address);
+					
+					if (new_physical_address != 0){
+						second_level_entry = new_physical_address | (second_level_entry & 0x00000fff);
+						tlb.add((i << 20) | (j << 12));
+						
+						if (reverse_map != nullptr){
+							reverse_map->move(physical_address, new_physical_address, this, (i << 20) | (j << 12));
+						}
+					}
+				}
+			}
+		}
+	}
+	
+	tlb.finish();
+}
+
 uint32_t * PageTable::get_first_level_table_address() {
 	return first_level_table;
 }
@@ -728,6 +1158,7 @@ UnitState get_state_from_descriptor(uint32_t descriptor){
 }
 
 Result<UnitState> PageTable::get_unit_state(uintptr_t virtual_address, AllocationGranularity granularity) {
+	InterruptGuard guard;
 	auto lock = spinlock_cs.acquire();
 	
 	switch (granularity){
@@ -797,15 +1228,23 @@ Result<UnitState> PageTable::get_unit_state(uintptr_t virtual_address, Allocatio
 	}
 }
 
-Result<uintptr_t> PageTable::virtual_to_physical(uintptr_t virtual_address) {
+Result<uintptr_t> PageTable::virtual_to_physical(uintptr_t virtual_address, bool allow_hardware) {
+	InterruptGuard guard;
 	auto lock = spinlock_cs.acquire();
 	
+	if (allow_hardware && PagingManager::IsActiveTable(*this, virtual_address)){
+		return PagingManager::TranslateAddress(virtual_address);
+	}
 	return virtual_to_physical_internal(virtual_address);
 }
 
 Result<uintptr_t> PageTable::physical_to_virtual(uintptr_t physical_address) {
+	InterruptGuard guard;
 	auto lock = spinlock_cs.acquire();
 	
+	if (reverse_map != nullptr && reverse_map->is_recorded(physical_address)){
+		return reverse_map->find(this, physical_address);
+	}
 	return physical_to_virtual_internal(physical_address);
 }
 
@@ -848,6 +1287,7 @@ void page_aggregation_display(
 }
 
 void PageTable::print_table_info() {
+	InterruptGuard guard;
 	auto lock = spinlock_cs.acquire();
 	
 	uintptr_t aggregation_start;
@@ -1000,6 +1440,8 @@ uint32_t get_num_allocation_units(size_t bytes, AllocationGranularity granularit
 	}
 }
 
+#ifndef HOST_BUILD
+//the host build has no MMU to drive
 void PagingManager::SetLowerPageTable(const PageTable &table) {
 	uintptr_t ttb = (uintptr_t)table.first_level_table & 0xffffc000;
 	asm volatile("mcr p15, 0, %[ttb], c2, c0, 0" : : [ttb] "r" (ttb));
@@ -1034,7 +1476,7 @@ void PagingManager::EnablePaging(){
 	asm volatile ("mcr p15, 0, %[dummy], c7, c5, 0" : : [dummy] "r" (0));
 	
 	//invalidate tlb
-	asm volatile ("mcr p15, 0, %[dummy], c8, c7, 0" : : [dummy] "r" (0));
+	tlb_invalidate_all();
 	
 	//memory barrier
 	std::atomic_thread_fence(std::memory_order_seq_cst);
@@ -1044,3 +1486,65 @@ void PagingManager::EnablePaging(){
 	asm volatile ("mcr p15, 0, %[status], c1, c0, 0" : : [status] "r" (status));
 }
 
+bool PagingManager::IsActiveTable(const PageTable &table, uintptr_t virtual_address) {
+	uint32_t status;
+	asm volatile ("mrc p15, 0, %[status], c1, c0, 0" : [status] "=r" (status));
+	if (!(status & 0x1)){
+		return false;
+	}
+	
+	//TTBCR.N splits the address space: TTBR0 covers the bottom 2^(32-N) bytes, and its table is aligned to 2^(14-N)
+	uint32_t control;
+	asm volatile ("mrc p15, 0, %[control], c2, c0, 2" : [control] "=r" (control));
+	uint32_t n = control & 0x7;
+	
+	uint32_t ttb;
+	if (n == 0 || (virtual_address >> (32 - n)) == 0){
+		if (control & 0x10){
+			return false;
+		}
+		asm volatile ("mrc p15, 0, %[ttb], c2, c0, 0" : [ttb] "=r" (ttb));
+		return (ttb & (0xffffffff << (14 - n))) == (uintptr_t)table.first_level_table;
+	} else {
+		if (control & 0x20){
+			return false;
+		}
+		asm volatile ("mrc p15, 0, %[ttb], c2, c0, 1" : [ttb] "=r" (ttb));
+		return (ttb & 0xffffc000) == (uintptr_t)table.first_level_table;
+	}
+}
+
+Result<uintptr_t> PagingManager::TranslateAddress(uintptr_t virtual_address) {
+	uint32_t pa;
+	
+	{
+		//an interrupt handler translating an address of its own in between would overwrite the result
+		InterruptGuard guard;
+		
+		asm volatile (
+			"mcr p15, 0, %[va], c7, c8, 0\n" //VA to PA translation, privileged read
+			"mcr p15, 0, %[zero], c7, c5, 4\n" //flush the prefetch buffer, so the result is in place
+			"mrc p15, 0, %[pa], c7, c4, 0\n" //PA register
+			: [pa] "=r" (pa) : [va] "r" (virtual_address), [zero] "r" (0) : "memory");
+	}
+	
+	if (pa & 0x00000001){
+		//abort
+		return Result<uintptr_t>::failure();
+	}
+	
+	//the register holds the address to the nearest 1KiB
+	return Result<uintptr_t>::success((pa & 0xfffffc00) | (virtual_address & 0x000003ff));
+}
+#else
+bool PagingManager::IsActiveTable(const PageTable &table, uintptr_t virtual_address) {
+	(void)table;
+	(void)virtual_address;
+	return false;
+}
+
+Result<uintptr_t> PagingManager::TranslateAddress(uintptr_t virtual_address) {
+	(void)virtual_address;
+	return Result<uintptr_t>::failure();
+}
+#endif
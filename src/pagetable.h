@@ -4,6 +4,8 @@
 #include "spinlock.h"
 #include "page_alloc.h"
 
+class ReverseMap;
+
 struct SecondLevelTableAddr {
 	uintptr_t physical_addr;
 	uint32_t (* virtual_addr)[];
@@ -12,12 +14,51 @@ struct SecondLevelTableAddr {
 const uint32_t FIRST_LEVEL_SUPERVISOR_ENTRIES = 0x1000;
 const uint32_t FIRST_LEVEL_USER_ENTRIES = 0x800;
 const uint32_t SECOND_LEVEL_ENTRIES = 0x100;
+const uint32_t SECOND_LEVEL_TABLE_SIZE = SECOND_LEVEL_ENTRIES * sizeof(uint32_t);
+const uint32_t SECOND_LEVEL_TABLES_PER_PAGE = PAGE_SIZE / SECOND_LEVEL_TABLE_SIZE;
 const uint32_t MAX_SECOND_LEVEL_TABLES = PAGE_SIZE / sizeof(SecondLevelTableAddr);
 
 const uint32_t SUPERVISOR_DOMAIN = 0;
 
 //first level page tables are 64KiB each
-//second level page tables are 1KiB each
+//second level page tables are 1KiB each, four to a page
+
+//second-level tables are carved out of pages a quarter at a time; each PageTable keeps its own free quarters on a
+//list linked through them, and a page's refcount is the number of tables in use in it, so that the page goes back to
+//PageAlloc with its last table (and ~PageTable only has to release each table)
+struct FreeSecondLevelTable {
+	FreeSecondLevelTable * prev;
+	FreeSecondLevelTable * next;
+};
+
+//second-level tables are indexed by the log2 of their longest run of free pages, 1 to 256
+const uint32_t SECOND_LEVEL_RUN_CLASSES = 9;
+
+//which parts of a table's address space are free, kept up to date by everything that reserves or releases, so that
+//reserve() finds a run without walking the descriptors: free first-level entries, 16-entry groups that are all free
+//(for supersections), and the longest run of free pages in each second-level table
+//bitmaps are MSB-first, as in HierarchicalBitmap; they and the runs are sized for the table's first-level entries, so
+//a user table's index fits in the half of its first-level table's pages that TTBR0 never walks (see
+//PagingManager::SetPagingMode), and a supervisor table's takes three pages of its own
+struct PageTableFreeIndex {
+	uint32_t * free_sections;
+	uint32_t * free_supersections;
+	uint32_t * tables_by_run[SECOND_LEVEL_RUN_CLASSES];
+	uint8_t * longest_run; //0 for an entry that isn't a second-level table; a run of 256 is only in the top run class
+	
+	static constexpr uint32_t get_bitmap_words(uint32_t num_entries){
+		return num_entries / 32 * (SECOND_LEVEL_RUN_CLASSES + 1) + num_entries / 16 / 32;
+	}
+	
+	void init(uint32_t * bitmaps, uint8_t * runs, uint32_t num_entries); //both must be zeroed
+	uint32_t get_longest_run(uint32_t index);
+};
+
+const uint32_t PAGE_TABLE_FREE_INDEX_BITMAP_PAGES = (PageTableFreeIndex::get_bitmap_words(FIRST_LEVEL_SUPERVISOR_ENTRIES) * sizeof(uint32_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+const uint32_t PAGE_TABLE_FREE_INDEX_RUN_PAGES = FIRST_LEVEL_SUPERVISOR_ENTRIES / PAGE_SIZE;
+
+static_assert((PAGE_TABLE_FREE_INDEX_BITMAP_PAGES & (PAGE_TABLE_FREE_INDEX_BITMAP_PAGES - 1)) == 0, "PageAlloc only hands out powers of two");
+static_assert(PageTableFreeIndex::get_bitmap_words(FIRST_LEVEL_USER_ENTRIES) * sizeof(uint32_t) + FIRST_LEVEL_USER_ENTRIES <= (FIRST_LEVEL_SUPERVISOR_ENTRIES - FIRST_LEVEL_USER_ENTRIES) * sizeof(uint32_t), "a user table's index has to fit after its first-level entries");
 
 enum class AllocationGranularity {
 	Page,
@@ -36,28 +77,45 @@ uint32_t get_num_allocation_units(size_t bytes, AllocationGranularity granularit
 class PageTable {
 private:
 	friend class PagingManager;
+	friend class PageAlloc;
 	
 	uint32_t * first_level_table;
 	uint32_t first_level_num_entries; //should be 4096 or 2048
 	bool reference_counted;
 	Spinlock spinlock_cs;
 	
+	PageTableFreeIndex free_index;
+	FreeSecondLevelTable * free_second_level_tables;
+	ReverseMap * reverse_map; //optional
+	
 	PageAlloc &page_alloc;
-
+	PageTable * next_movable_table; //owned by page_alloc
+	
+	void migrate_pages(uintptr_t start, uintptr_t end);
+	
 	Result<uintptr_t> virtual_to_physical_internal(uintptr_t virtual_address);
 	Result<uintptr_t> physical_to_virtual_internal(uintptr_t physical_address);
 	
+	//the lock must be held for these
 	uint32_t * create_second_level_table();
+	void free_second_level_table(uint32_t * table);
+	void push_free_second_level_table(FreeSecondLevelTable * table);
+	void remove_free_second_level_table(FreeSecondLevelTable * table);
 	
 	uint32_t * get_first_level_table_address();
 	uint32_t * get_second_level_table_address(uintptr_t physical_base_address);
 	
 	void print_second_level_table_info(uint32_t * table, uintptr_t base);
 	
-	Result<uintptr_t> reserve_pages(uint32_t num_pages);
-	Result<uintptr_t> reserve_sections(uint32_t num_sections);
-	Result<uintptr_t> reserve_supersections(uint32_t num_supersections);
-
+	//the lock must be held for these; they bring free_index up to date after descriptors have changed
+	void index_sections(uint32_t first_index, uint32_t count, bool free);
+	void index_second_level_table(uint32_t index);
+	
+	//these search the first-level entries [first_index, end_index)
+	Result<uintptr_t> reserve_pages(uint32_t num_pages, uint32_t first_index, uint32_t end_index);
+	Result<uintptr_t> reserve_sections(uint32_t num_sections, uint32_t first_index, uint32_t end_index);
+	Result<uintptr_t> reserve_supersections(uint32_t num_supersections, uint32_t first_index, uint32_t end_index);
+	
 	Result<uintptr_t> reserve_pages(uintptr_t base, uint32_t num_pages);
 	Result<uintptr_t> reserve_sections(uintptr_t base, uint32_t num_sections);
 	Result<uintptr_t> reserve_supersections(uintptr_t base, uint32_t num_supersections);
@@ -69,26 +127,41 @@ private:
 	bool commit_section(uintptr_t virtual_address, uintptr_t physical_address);
 	bool commit_supersection(uintptr_t virtual_address, uintptr_t physical_address);
 	
+	bool uncommit(uintptr_t virtual_address, uint32_t units, AllocationGranularity granularity, bool release_reservation);
+	void free_empty_second_level_tables(uint32_t first_index, uint32_t end_index);
+	
 	Result<uint32_t*> get_page_descriptor(uintptr_t virtual_address);
 	Result<uint32_t*> get_section_descriptor(uintptr_t virtual_address, bool allow_second_level);
 public:
-	PageTable(PageAlloc &_page_alloc, bool is_supervisor, bool is_reference_counted = true);
+	//with a reverse map, every unit committed is recorded in it, and physical_to_virtual looks there instead of
+	//walking the table
+	PageTable(PageAlloc &_page_alloc, bool is_supervisor, bool is_reference_counted = true, ReverseMap * _reverse_map = nullptr);
 	PageTable(const PageTable &other) = delete; //we don't want this to be copy-constructed
 	~PageTable();
 	
 	Result<uintptr_t> reserve(uint32_t units, AllocationGranularity granularity);
 	Result<uintptr_t> reserve(uintptr_t address, uint32_t units, AllocationGranularity granularity);
+	Result<uintptr_t> reserve_within(uintptr_t start, uintptr_t end, uint32_t units, AllocationGranularity granularity); //anywhere in [start, end)
 	
 	Result<uintptr_t> reserve_allocate(uint32_t units, AllocationGranularity granularity);
 	Result<uintptr_t> reserve_allocate(uintptr_t virtual_address, uint32_t units, AllocationGranularity granularity);
-
+	
 	bool allocate(uintptr_t virtual_address, uint32_t units, AllocationGranularity granularity);
 	
 	bool map(uintptr_t virtual_address, uintptr_t physical_address, uint32_t units, AllocationGranularity granularity);
 	
+	//decommit returns committed units to reserved, and release returns committed or reserved units to free; either
+	//fails without changing anything unless every unit is in a state it can take
+	//the whole range is done under one lock, dropping the references it held a physically contiguous run at a time,
+	//and release also frees any second-level table it leaves empty
+	bool decommit(uintptr_t virtual_address, uint32_t units, AllocationGranularity granularity);
+	bool release(uintptr_t virtual_address, uint32_t units, AllocationGranularity granularity);
+	
 	Result<UnitState> get_unit_state(uintptr_t virtual_address, AllocationGranularity granularity);
 	
-	Result<uintptr_t> virtual_to_physical(uintptr_t virtual_address);
+	//when this is the table the MMU walks for virtual_address, the MMU translates it (see PagingManager::TranslateAddress)
+	//instead of the table being walked in software, unless allow_hardware is false
+	Result<uintptr_t> virtual_to_physical(uintptr_t virtual_address, bool allow_hardware = true);
 	Result<uintptr_t> physical_to_virtual(uintptr_t physical_address);
 	
 	void print_table_info();
@@ -100,6 +173,14 @@ public:
 	static void SetUpperPageTable(const PageTable &table);
 	static void SetPagingMode(bool lower_enable, bool upper_enable);
 	static void EnablePaging();
+	
+	//whether the MMU walks table for virtual_address: TTBR0's table below the TTBCR boundary, TTBR1's above it, as
+	//long as paging is on and walks through that half aren't disabled
+	static bool IsActiveTable(const PageTable &table, uintptr_t virtual_address);
+	
+	//the MMU's own translation (a privileged read) through the active tables, so it is only as current as the TLB
+	//maintenance done after changing them; always fails on the host
+	static Result<uintptr_t> TranslateAddress(uintptr_t virtual_address);
 };
 
 
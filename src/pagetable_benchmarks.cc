@@ -0,0 +1,73 @@
+#include "runtime_benchmarks.h"
+#include "cpu.h"
+#include "kmalloc.h"
+#include "pagetable.h"
+#include "pmu.h"
+#include "uart.h"
+
+//the physical address of each page of a buffer, as setting up DMA to it would look them up: translated by the MMU
+//(the table is the active TTBR1 table) and by walking the table in software
+//the buffer is big enough to come from vmalloc, so its pages are mapped one by one in the supervisor table
+
+const uint32_t TRANSLATION_BENCH_PAGES = 16;
+const uint32_t TRANSLATION_BENCH_PASSES = 256;
+
+static PmuCounts translate_buffer(PageTable &table, uintptr_t buffer, bool allow_hardware, uint32_t * mismatches){
+	PmuCounts counts;
+	
+	InterruptGuard guard;
+	
+	pmu_start(PmuEvent::InstructionExecuted, PmuEvent::DataCacheMiss);
+	for (uint32_t pass = 0; pass < TRANSLATION_BENCH_PASSES; pass++){
+		for (uint32_t i = 0; i < TRANSLATION_BENCH_PAGES; i++){
+			auto physical = table.virtual_to_physical(buffer + i * PAGE_SIZE + 0x10, allow_hardware);
+			
+			if (!physical.is_success || (physical.value & (PAGE_SIZE - 1)) != 0x10){
+				(*mismatches)++;
+			}
+		}
+	}
+	counts = pmu_read();
+	pmu_stop();
+	
+	return counts;
+}
+
+void bench_virtual_to_physical(PageTable &supervisor_table){
+	uintptr_t buffer = (uintptr_t)kmalloc(TRANSLATION_BENCH_PAGES * PAGE_SIZE);
+	uint32_t mismatches = 0;
+	
+	//both ways have to agree before either is worth timing
+	for (uint32_t i = 0; i < TRANSLATION_BENCH_PAGES; i++){
+		auto hardware = supervisor_table.virtual_to_physical(buffer + i * PAGE_SIZE, true);
+		auto software = supervisor_table.virtual_to_physical(buffer + i * PAGE_SIZE, false);
+		
+		if (!hardware.is_success || !software.is_success || hardware.value != software.value){
+			mismatches++;
+		}
+	}
+	
+	PmuCounts software = translate_buffer(supervisor_table, buffer, false, &mismatches);
+	PmuCounts hardware = translate_buffer(supervisor_table, buffer, true, &mismatches);
+	
+	uint32_t translations = TRANSLATION_BENCH_PAGES * TRANSLATION_BENCH_PASSES;
+	
+	uart_puts("virtual_to_physical: cycles / instructions / data cache misses per translation, software walk ");
+	uart_putdec(software.cycles / translations);
+	uart_puts(" / ");
+	uart_putdec(software.event0 / translations);
+	uart_puts(" / ");
+	uart_putdec(software.event1 / translations);
+	uart_puts(", MMU ");
+	uart_putdec(hardware.cycles / translations);
+	uart_puts(" / ");
+	uart_putdec(hardware.event0 / translations);
+	uart_puts(" / ");
+	uart_putdec(hardware.event1 / translations);
+	uart_puts(", ");
+	uart_putdec(mismatches);
+	uart_puts(" mismatches");
+	uart_putline();
+	
+	kfree((void*)buffer);
+}
@@ -1,5 +1,6 @@
 #include "runtime_tests.h"
 #include "pagetable.h"
+#include "reverse_map.h"
 #include "uart.h"
 #include "page_alloc.h"
 
@@ -248,6 +249,38 @@ bool test_reservations(PageAlloc &page_alloc) {
 			uart_puts("failed\r\n");
 		}
 	
+		uart_puts("Free index sized to the table: ");
+		{
+			MemStats stats_before = page_alloc.get_mem_stats();
+			{
+				//a supervisor table's index takes pages of its own, and a user table's is in its first-level table's
+				PageTable supervisor_table(page_alloc, true, false);
+				all_passed &= page_alloc.get_mem_stats().usedmem - stats_before.usedmem == (4 + PAGE_TABLE_FREE_INDEX_BITMAP_PAGES + PAGE_TABLE_FREE_INDEX_RUN_PAGES) * PAGE_SIZE;
+			}
+			{
+				PageTable user_table(page_alloc, false);
+				all_passed &= page_alloc.get_mem_stats().usedmem - stats_before.usedmem == 4 * PAGE_SIZE;
+				
+				//every entry, up to the last one before the index, is indexed
+				all_passed &= user_table.reserve(0x7ff00000, 1, AllocationGranularity::Section).is_success;
+				all_passed &= user_table.reserve(0x7fe00000, 1, AllocationGranularity::Page).is_success;
+				
+				auto reservation = user_table.reserve(FIRST_LEVEL_USER_ENTRIES - 2, AllocationGranularity::Section);
+				all_passed &= reservation.is_success && reservation.value == 0;
+				all_passed &= not user_table.reserve(1, AllocationGranularity::Section).is_success;
+				
+				reservation = user_table.reserve(SECOND_LEVEL_ENTRIES - 1, AllocationGranularity::Page);
+				all_passed &= reservation.is_success && reservation.value == 0x7fe01000;
+				all_passed &= not user_table.reserve(1, AllocationGranularity::Page).is_success;
+			}
+			all_passed &= page_alloc.get_mem_stats().usedmem == stats_before.usedmem;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+	
 		uart_putline();
 	
 		table.print_table_info();
@@ -265,11 +298,307 @@ bool test_reservations(PageAlloc &page_alloc) {
 	return all_passed;
 }
 
+bool test_decommit_release(PageAlloc &page_alloc) {
+	bool all_passed = true;
+	
+	MemStats stats_i = page_alloc.get_mem_stats();
+	
+	{
+		PageTable table(page_alloc, true);
+		
+		uart_puts("Decommit pages: ");
+		all_passed &= table.reserve_allocate(0x10000000, 8, AllocationGranularity::Page).is_success;
+		{
+			MemStats stats_before = page_alloc.get_mem_stats();
+			all_passed &= table.decommit(0x10000000, 8, AllocationGranularity::Page);
+			MemStats stats_after = page_alloc.get_mem_stats();
+			
+			all_passed &= stats_before.usedmem - stats_after.usedmem == 8 * PAGE_SIZE;
+			for (uint32_t i = 0, addr = 0x10000000; i < 8; i++, addr += 0x1000){
+				auto check = table.get_unit_state(addr, AllocationGranularity::Page);
+				all_passed &= check.is_success && check.value == UnitState::Reserved;
+			}
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Release pages and their second-level table: ");
+		all_passed &= table.allocate(0x10000000, 4, AllocationGranularity::Page);
+		{
+			MemStats stats_before = page_alloc.get_mem_stats();
+			all_passed &= table.release(0x10000000, 8, AllocationGranularity::Page);
+			MemStats stats_after = page_alloc.get_mem_stats();
+			
+			all_passed &= stats_before.usedmem - stats_after.usedmem == 5 * PAGE_SIZE;
+			auto check = table.get_unit_state(0x10000000, AllocationGranularity::Section);
+			all_passed &= check.is_success && check.value == UnitState::Free;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Second-level tables share pages: ");
+		{
+			MemStats stats_before = page_alloc.get_mem_stats();
+			for (uint32_t i = 0; i < SECOND_LEVEL_TABLES_PER_PAGE; i++){
+				all_passed &= table.reserve(0x10000000 + i * SECTION_SIZE, 1, AllocationGranularity::Page).is_success;
+			}
+			MemStats stats_after = page_alloc.get_mem_stats();
+			all_passed &= stats_after.usedmem - stats_before.usedmem == PAGE_SIZE;
+			
+			//the page only goes with the last of its tables, whatever order they go in
+			all_passed &= table.release(0x10200000, 1, AllocationGranularity::Page);
+			all_passed &= table.release(0x10000000, 1, AllocationGranularity::Page);
+			all_passed &= table.release(0x10300000, 1, AllocationGranularity::Page);
+			all_passed &= page_alloc.get_mem_stats().usedmem == stats_after.usedmem;
+			all_passed &= table.release(0x10100000, 1, AllocationGranularity::Page);
+			all_passed &= page_alloc.get_mem_stats().usedmem == stats_before.usedmem;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Release of free pages: ");
+		all_passed &= table.reserve(0x10000000, 1, AllocationGranularity::Page).is_success;
+		all_passed &= not table.release(0x10000000, 2, AllocationGranularity::Page);
+		{
+			auto check = table.get_unit_state(0x10000000, AllocationGranularity::Page);
+			all_passed &= check.is_success && check.value == UnitState::Reserved;
+		}
+		all_passed &= table.release(0x10000000, 1, AllocationGranularity::Page);
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Decommit and release a section: ");
+		all_passed &= table.reserve_allocate(0x20000000, 1, AllocationGranularity::Section).is_success;
+		all_passed &= not table.decommit(0x20000000, 1, AllocationGranularity::Supersection);
+		all_passed &= table.decommit(0x20000000, 1, AllocationGranularity::Section);
+		{
+			auto check = table.get_unit_state(0x20000000, AllocationGranularity::Section);
+			all_passed &= check.is_success && check.value == UnitState::Reserved;
+		}
+		all_passed &= table.release(0x20000000, 1, AllocationGranularity::Section);
+		{
+			auto check = table.get_unit_state(0x20000000, AllocationGranularity::Section);
+			all_passed &= check.is_success && check.value == UnitState::Free;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Nonspecific reservation spanning second-level tables: ");
+		{
+			auto reservation = table.reserve(300, AllocationGranularity::Page);
+			all_passed &= reservation.is_success;
+			
+			for (uint32_t i = 0, addr = reservation.value; i < 300; i++, addr += 0x1000){
+				auto check = table.get_unit_state(addr, AllocationGranularity::Page);
+				all_passed &= check.is_success && check.value == UnitState::Reserved;
+			}
+			all_passed &= table.release(reservation.value, 300, AllocationGranularity::Page);
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Many nonspecific reservations, and reuse of released ones: ");
+		{
+			const uint32_t NUM_REGIONS = 1024;
+			static uintptr_t regions[NUM_REGIONS];
+			
+			for (uint32_t i = 0; i < NUM_REGIONS; i++){
+				auto reservation = table.reserve(1 + i % 13, AllocationGranularity::Page);
+				all_passed &= reservation.is_success;
+				regions[i] = reservation.value;
+				
+				auto check = table.get_unit_state(reservation.value + (i % 13) * PAGE_SIZE, AllocationGranularity::Page);
+				all_passed &= check.is_success && check.value == UnitState::Reserved;
+			}
+			
+			//the largest regions go, and the space they leave should take as many again without another table
+			for (uint32_t i = 12; i < NUM_REGIONS; i += 13){
+				all_passed &= table.release(regions[i], 1 + i % 13, AllocationGranularity::Page);
+			}
+			MemStats stats_before = page_alloc.get_mem_stats();
+			for (uint32_t i = 12; i < NUM_REGIONS; i += 13){
+				auto reservation = table.reserve(1 + i % 13, AllocationGranularity::Page);
+				all_passed &= reservation.is_success;
+				regions[i] = reservation.value;
+			}
+			MemStats stats_after = page_alloc.get_mem_stats();
+			all_passed &= stats_after.usedmem == stats_before.usedmem;
+			
+			//a release fails unless every page is still reserved, so this also catches regions that overlapped
+			for (uint32_t i = 0; i < NUM_REGIONS; i++){
+				all_passed &= table.release(regions[i], 1 + i % 13, AllocationGranularity::Page);
+			}
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Reservation within a range: ");
+		{
+			auto reservation = table.reserve_within(0xc0000000, 0xd0000000, 16, AllocationGranularity::Page);
+			all_passed &= reservation.is_success && reservation.value >= 0xc0000000 && reservation.value < 0xd0000000;
+			
+			all_passed &= not table.reserve_within(0xc0000000, 0xc0100000, 2, AllocationGranularity::Section).is_success;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_putline();
+	}
+	
+	MemStats stats_f = page_alloc.get_mem_stats();
+	
+	if (stats_i.usedmem != stats_f.usedmem){
+		uart_puts("Leaked ");
+		uart_puthex(stats_f.usedmem - stats_i.usedmem);
+		uart_puts(" bytes\r\n");
+		all_passed = false;
+	}
+	
+	return all_passed;
+}
+
+bool test_reverse_map(PageAlloc &page_alloc) {
+	bool all_passed = true;
+	
+	MemStats stats_i = page_alloc.get_mem_stats();
+	
+	{
+		ReverseMap reverse_map(page_alloc);
+		PageTable table(page_alloc, true, true, &reverse_map);
+		PageTable other_table(page_alloc, false, true, &reverse_map);
+		
+		uart_puts("Reverse lookup of pages: ");
+		all_passed &= table.reserve_allocate(0x10000000, 8, AllocationGranularity::Page).is_success;
+		for (uint32_t i = 0, addr = 0x10000000; i < 8; i++, addr += 0x1000){
+			auto physical = table.virtual_to_physical(addr);
+			all_passed &= physical.is_success;
+			
+			auto check = table.physical_to_virtual(physical.value + 0x123);
+			all_passed &= check.is_success && check.value == addr + 0x123;
+			all_passed &= reverse_map.get_num_mappings(physical.value) == 1;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Reverse lookup of a section and a supersection: ");
+		all_passed &= table.reserve_allocate(0x20000000, 1, AllocationGranularity::Section).is_success;
+		all_passed &= table.reserve_allocate(0x30000000, 1, AllocationGranularity::Supersection).is_success;
+		{
+			auto physical = table.virtual_to_physical(0x20000000);
+			auto check = table.physical_to_virtual(physical.value + 0x54321);
+			all_passed &= physical.is_success && check.is_success && check.value == 0x20054321;
+			
+			physical = table.virtual_to_physical(0x30000000);
+			check = table.physical_to_virtual(physical.value + 0xabcdef);
+			all_passed &= physical.is_success && check.is_success && check.value == 0x30abcdef;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Page shared between tables: ");
+		{
+			uintptr_t physical = table.virtual_to_physical(0x10000000).value;
+			
+			all_passed &= other_table.reserve(0x00400000, 1, AllocationGranularity::Page).is_success;
+			all_passed &= other_table.map(0x00400000, physical, 1, AllocationGranularity::Page);
+			all_passed &= reverse_map.get_num_mappings(physical) == 2;
+			
+			auto check = other_table.physical_to_virtual(physical);
+			all_passed &= check.is_success && check.value == 0x00400000;
+			check = table.physical_to_virtual(physical);
+			all_passed &= check.is_success && check.value == 0x10000000;
+			
+			//releasing it in one table leaves the other's mapping
+			all_passed &= table.release(0x10000000, 1, AllocationGranularity::Page);
+			all_passed &= not table.physical_to_virtual(physical).is_success;
+			check = other_table.physical_to_virtual(physical);
+			all_passed &= check.is_success && check.value == 0x00400000;
+			all_passed &= reverse_map.get_num_mappings(physical) == 1;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_puts("Reverse lookup by walking the table: ");
+		{
+			//no reverse map, and mmio-like addresses mapped away from their identity
+			PageTable walked_table(page_alloc, true, false);
+			
+			all_passed &= walked_table.reserve(0x40000000, 1, AllocationGranularity::Section).is_success;
+			all_passed &= walked_table.map(0x40000000, 0x20000000, 1, AllocationGranularity::Section);
+			all_passed &= walked_table.reserve(0x50000000, 1, AllocationGranularity::Supersection).is_success;
+			all_passed &= walked_table.map(0x50000000, 0x21000000, 1, AllocationGranularity::Supersection);
+			all_passed &= walked_table.reserve(0x60003000, 1, AllocationGranularity::Page).is_success;
+			all_passed &= walked_table.map(0x60003000, 0x20345000, 1, AllocationGranularity::Page);
+			
+			auto check = walked_table.physical_to_virtual(0x20054321);
+			all_passed &= check.is_success && check.value == 0x40054321;
+			check = walked_table.physical_to_virtual(0x21abcdef);
+			all_passed &= check.is_success && check.value == 0x50abcdef;
+			check = walked_table.physical_to_virtual(0x20345678);
+			all_passed &= check.is_success && check.value == 0x60003678;
+			all_passed &= not walked_table.physical_to_virtual(0x22000000).is_success;
+		}
+		if (all_passed) {
+			uart_puts("passed\r\n");
+		} else {
+			uart_puts("failed\r\n");
+		}
+		
+		uart_putline();
+	}
+	
+	MemStats stats_f = page_alloc.get_mem_stats();
+	
+	if (stats_i.usedmem != stats_f.usedmem){
+		uart_puts("Leaked ");
+		uart_puthex(stats_f.usedmem - stats_i.usedmem);
+		uart_puts(" bytes\r\n");
+		all_passed = false;
+	}
+	
+	return all_passed;
+}
+
 bool test_pagetables(PageAlloc &page_alloc) {
 	bool all_passed = true;
 	
 	//non-short circuit
 	all_passed &= test_reservations(page_alloc);
+	all_passed &= test_decommit_release(page_alloc);
+	all_passed &= test_reverse_map(page_alloc);
 	
 	return all_passed;
 }
@@ -2,6 +2,10 @@
 
 #include "uart.h"
 
+#ifdef HOST_BUILD
+#include <cstdlib>
+#endif
+
 void panic(PanicCodes code){
 	uart_puts("Kernel Panic\r\n");
 	uart_puthex((uint32_t)code);
@@ -41,6 +45,9 @@ void panic(PanicCodes code){
 		case PanicCodes::AllocationInNonReferenceCountedTable:
 			msg = "Allocation in non-reference-counted page table";
 			break;
+		case PanicCodes::SampledHeapFault:
+			msg = "Use after free or overflow of a sampled heap allocation";
+			break;
 		default:
 			msg = "Unknown error";
 			break;
@@ -50,8 +57,12 @@ void panic(PanicCodes code){
 	uart_puts(msg);
 	uart_puts("\r\n");
 	
+#ifdef HOST_BUILD
+	abort();
+#else
 	while (true){
 		asm volatile("wfe");
 	}
+#endif
 }
 
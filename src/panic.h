@@ -14,6 +14,7 @@ enum PanicCodes {
 	AssertionFailure,
 	PureVirtualFunctionCall,
 	AllocationInNonReferenceCountedTable,
+	SampledHeapFault, //an access to a guard page or a freed page of a sampled kmalloc allocation
 };
 
 void panic(PanicCodes code) __attribute__((noreturn));
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+
+//the ARM1176 performance monitor: a cycle counter and two event counters, all 32 bits, driven through CP15 c15
+//counting is global, so a measurement covers whatever runs between pmu_start and pmu_read, interrupts included
+//the host build has no PMU, so every count reads as 0 there
+
+enum class PmuEvent : uint8_t {
+	InstructionCacheMiss = 0x00,
+	DataMicroTlbMiss = 0x04,
+	InstructionExecuted = 0x07,
+	DataCacheAccess = 0x09, //cacheable accesses only
+	DataCacheMiss = 0x0b,
+	DataCacheWriteback = 0x0c,
+	MainTlbMiss = 0x0f,
+};
+
+struct PmuCounts {
+	uint32_t cycles;
+	uint32_t event0;
+	uint32_t event1;
+};
+
+//resets all three counters and starts them, counting event0 and event1
+inline void pmu_start(PmuEvent event0, PmuEvent event1) {
+#ifdef HOST_BUILD
+	(void)event0;
+	(void)event1;
+#else
+	//PMNC: event 0 in [27:20], event 1 in [19:12], clear the overflow flags [10:8], reset the cycle counter (C) and
+	//the event counters (P), enable (E)
+	uint32_t pmnc = ((uint32_t)event0 << 20) | ((uint32_t)event1 << 12) | 0x700 | 0x7;
+	asm volatile("mcr p15, 0, %[pmnc], c15, c12, 0" : : [pmnc] "r" (pmnc) : "memory");
+#endif
+}
+
+inline PmuCounts pmu_read() {
+	PmuCounts retval = {0, 0, 0};
+
+#ifndef HOST_BUILD
+	asm volatile(
+		"mrc p15, 0, %[ccnt], c15, c12, 1\n"
+		"mrc p15, 0, %[pmn0], c15, c12, 2\n"
+		"mrc p15, 0, %[pmn1], c15, c12, 3\n"
+		: [ccnt] "=r" (retval.cycles), [pmn0] "=r" (retval.event0), [pmn1] "=r" (retval.event1) : : "memory");
+#endif
+
+	return retval;
+}
+
+inline void pmu_stop() {
+#ifndef HOST_BUILD
+	asm volatile("mcr p15, 0, %[pmnc], c15, c12, 0" : : [pmnc] "r" (0) : "memory");
+#endif
+}
@@ -0,0 +1,191 @@
+#include "reverse_map.h"
+
+#include "cpu.h"
+#include "panic.h"
+
+static uint32_t get_unit_size(AllocationGranularity granularity){
+	switch (granularity){
+		case AllocationGranularity::Page:
+			return PAGE_SIZE;
+		case AllocationGranularity::Section:
+			return SECTION_SIZE;
+		default:
+			return SUPERSECTION_SIZE;
+	}
+}
+
+ReverseMap::ReverseMap(PageAlloc &_page_alloc) :
+	page_alloc(_page_alloc), pages(nullptr), free_mappings(nullptr)
+{
+	num_frames = page_alloc.get_mem_stats().totalmem / PAGE_SIZE;
+	
+	//blocks from PageAlloc are a power of two
+	heads_pages = 1;
+	while (heads_pages * PAGE_SIZE < num_frames * sizeof(ReverseMapping*)){
+		heads_pages *= 2;
+	}
+	
+	heads = (ReverseMapping**)page_alloc.alloc(heads_pages);
+	for (uint32_t i = 0; i < num_frames; i++){
+		heads[i] = nullptr;
+	}
+}
+
+ReverseMap::~ReverseMap(){
+	while (pages != nullptr){
+		ReverseMapping * page = pages;
+		pages = page->next;
+		page_alloc.ref_release((uintptr_t)page);
+	}
+	
+	page_alloc.ref_release_range((uintptr_t)heads, heads_pages);
+}
+
+ReverseMapping * ReverseMap::take_mapping(){
+	{
+		InterruptGuard guard;
+		auto lock = spinlock_cs.acquire();
+		
+		if (free_mappings != nullptr){
+			ReverseMapping * mapping = free_mappings;
+			free_mappings = mapping->next;
+			return mapping;
+		}
+	}
+	
+	//the page is allocated without the lock held, since compaction moves pages through the map
+	ReverseMapping * page = (ReverseMapping*)page_alloc.alloc(1);
+	
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	page->next = pages;
+	pages = page;
+	
+	//the first mapping is the page's link, and the second is handed out
+	for (uint32_t i = 2; i < REVERSE_MAPPINGS_PER_PAGE; i++){
+		page[i].next = free_mappings;
+		free_mappings = &page[i];
+	}
+	
+	return &page[1];
+}
+
+bool ReverseMap::is_recorded(uintptr_t physical_address){
+	return physical_address / PAGE_SIZE < num_frames;
+}
+
+void ReverseMap::add(uintptr_t physical_address, PageTable * table, uintptr_t virtual_address, AllocationGranularity granularity){
+	uint32_t frame = physical_address / PAGE_SIZE;
+	if (frame >= num_frames){
+		return;
+	}
+	
+	ReverseMapping * mapping = take_mapping();
+	mapping->table = table;
+	mapping->virtual_address = (virtual_address & ~(PAGE_SIZE - 1)) | (uint32_t)granularity;
+	
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	mapping->next = heads[frame];
+	heads[frame] = mapping;
+}
+
+void ReverseMap::remove(uintptr_t physical_address, PageTable * table, uintptr_t virtual_address){
+	uint32_t frame = physical_address / PAGE_SIZE;
+	if (frame >= num_frames){
+		return;
+	}
+	
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	for (ReverseMapping ** link = &heads[frame]; *link != nullptr; link = &(*link)->next){
+		ReverseMapping * mapping = *link;
+		
+		if (mapping->table == table && (mapping->virtual_address & ~(PAGE_SIZE - 1)) == (virtual_address & ~(PAGE_SIZE - 1))){
+			*link = mapping->next;
+			
+			mapping->next = free_mappings;
+			free_mappings = mapping;
+			return;
+		}
+	}
+	
+	//the table committed a unit without recording it
+	panic(PanicCodes::AssertionFailure);
+}
+
+void ReverseMap::move(uintptr_t physical_address, uintptr_t new_physical_address, PageTable * table, uintptr_t virtual_address){
+	uint32_t frame = physical_address / PAGE_SIZE;
+	uint32_t new_frame = new_physical_address / PAGE_SIZE;
+	if (frame >= num_frames || new_frame >= num_frames){
+		panic(PanicCodes::IncompatibleParameter);
+	}
+	
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	for (ReverseMapping ** link = &heads[frame]; *link != nullptr; link = &(*link)->next){
+		ReverseMapping * mapping = *link;
+		
+		if (mapping->table == table && (mapping->virtual_address & ~(PAGE_SIZE - 1)) == (virtual_address & ~(PAGE_SIZE - 1))){
+			*link = mapping->next;
+			
+			mapping->next = heads[new_frame];
+			heads[new_frame] = mapping;
+			return;
+		}
+	}
+	
+	panic(PanicCodes::AssertionFailure);
+}
+
+Result<uintptr_t> ReverseMap::find(PageTable * table, uintptr_t physical_address){
+	//the frames a page, a section and a supersection holding the address would start at
+	uintptr_t unit_starts[3] = {
+		physical_address & ~(PAGE_SIZE - 1),
+		physical_address & ~(SECTION_SIZE - 1),
+		physical_address & ~(SUPERSECTION_SIZE - 1),
+	};
+	
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	for (uint32_t i = 0; i < 3; i++){
+		uintptr_t unit_start = unit_starts[i];
+		uint32_t frame = unit_start / PAGE_SIZE;
+		
+		if ((i > 0 && unit_start == unit_starts[i - 1]) || frame >= num_frames){
+			continue;
+		}
+		
+		for (ReverseMapping * mapping = heads[frame]; mapping != nullptr; mapping = mapping->next){
+			uint32_t unit_size = get_unit_size((AllocationGranularity)(mapping->virtual_address & (PAGE_SIZE - 1)));
+			
+			if (mapping->table == table && physical_address - unit_start < unit_size){
+				return Result<uintptr_t>::success((mapping->virtual_address & ~(PAGE_SIZE - 1)) + (physical_address - unit_start));
+			}
+		}
+	}
+	
+	return Result<uintptr_t>::failure();
+}
+
+uint32_t ReverseMap::get_num_mappings(uintptr_t physical_address){
+	uint32_t frame = physical_address / PAGE_SIZE;
+	if (frame >= num_frames){
+		return 0;
+	}
+	
+	InterruptGuard guard;
+	auto lock = spinlock_cs.acquire();
+	
+	uint32_t retval = 0;
+	for (ReverseMapping * mapping = heads[frame]; mapping != nullptr; mapping = mapping->next){
+		retval++;
+	}
+	
+	return retval;
+}
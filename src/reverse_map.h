@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+#include "page_alloc.h"
+#include "pagetable.h"
+#include "spinlock.h"
+
+//which PageTables map each physical frame, and at what virtual address: the reverse of their descriptors, kept by
+//the tables that are given one when they are constructed, so that physical_to_virtual doesn't have to walk the table
+//a committed unit is recorded once, against the frame it starts at; a lookup also looks at the frames the section and
+//supersection around the address start at, so it reads at most three list heads, and each list is only as long as the
+//number of times its frame is mapped
+//frames outside RAM (mmio) aren't recorded
+//one map can be shared by any number of tables, and must outlive them
+
+struct ReverseMapping {
+	ReverseMapping * next; //the next mapping of the same frame
+	PageTable * table;
+	uintptr_t virtual_address; //of the unit; the low bits hold its AllocationGranularity
+};
+
+const uint32_t REVERSE_MAPPINGS_PER_PAGE = PAGE_SIZE / sizeof(ReverseMapping);
+
+class ReverseMap {
+private:
+	PageAlloc &page_alloc;
+	uint32_t num_frames;
+	uint32_t heads_pages;
+	ReverseMapping ** heads; //a list for each frame
+	
+	//mappings are carved out of pages from page_alloc, which are kept until the map is destroyed; the first mapping in
+	//each page links the pages together instead
+	ReverseMapping * pages;
+	ReverseMapping * free_mappings;
+	
+	Spinlock spinlock_cs;
+	
+	ReverseMapping * take_mapping();
+public:
+	ReverseMap(PageAlloc &_page_alloc);
+	ReverseMap(const ReverseMap &other) = delete;
+	~ReverseMap(); //every table using the map must have been destroyed
+	
+	bool is_recorded(uintptr_t physical_address);
+	
+	//called by PageTable as units are committed, uncommitted and migrated; physical_address is the start of the unit
+	void add(uintptr_t physical_address, PageTable * table, uintptr_t virtual_address, AllocationGranularity granularity);
+	void remove(uintptr_t physical_address, PageTable * table, uintptr_t virtual_address);
+	void move(uintptr_t physical_address, uintptr_t new_physical_address, PageTable * table, uintptr_t virtual_address); //doesn't allocate, so PageAlloc::compact can use it
+	
+	//the virtual address table maps physical_address at; if it maps it more than once, any of them
+	Result<uintptr_t> find(PageTable * table, uintptr_t physical_address);
+	uint32_t get_num_mappings(uintptr_t physical_address); //in every table, of units starting at this frame
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "common.h"
+#include "page_alloc.h"
+#include "pagetable.h"
+
+//benchmarks that need the real hardware (the PMU, the caches and TLBs), run by the kernel when built with RUN_BENCHMARKS
+//kmalloc must have been initialised; results go to the UART
+
+void bench_slab_coloring();
+void bench_kmalloc_aligned();
+void bench_section_heap(PageAlloc &page_alloc);
+void bench_virtual_to_physical(PageTable &supervisor_table);
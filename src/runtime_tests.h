@@ -1,5 +1,10 @@
 #pragma once
 
 #include "common.h"
+#include "page_alloc.h"
 
-bool test_pagetables();
+bool test_page_alloc(PageAlloc &page_alloc);
+bool test_pagetables(PageAlloc &page_alloc);
+bool test_slab(PageAlloc &page_alloc);
+bool test_kmalloc(PageAlloc &page_alloc);
+bool test_object_cache(PageAlloc &page_alloc);
@@ -0,0 +1,311 @@
+#include "slab.h"
+
+#include "cpu.h"
+#include "panic.h"
+
+static PageAlloc * slab_page_alloc = nullptr;
+
+static Spinlock sections_spinlock_cs;
+static SlabSection * sections = nullptr;
+static uint32_t num_sections = 0;
+
+void slab_init(PageAlloc &page_alloc){
+	slab_page_alloc = &page_alloc;
+}
+
+void slab_cache_init(SlabCache &cache, uint32_t object_size, uint32_t slab_pages, uint32_t alignment, bool colored, bool section_backed){
+	uint32_t first_offset = slab_first_offset(alignment);
+	uint32_t slab_size = slab_pages * PAGE_SIZE;
+	
+	if (object_size == 0 || object_size > slab_size - first_offset){
+		panic(PanicCodes::IncompatibleParameter);
+	}
+	//runs of pages are found a bitmap word at a time
+	if (section_backed && slab_pages > 32){
+		panic(PanicCodes::IncompatibleParameter);
+	}
+	
+	cache.object_size = object_size;
+	cache.slab_pages = slab_pages;
+	cache.first_offset = first_offset;
+	cache.objects_per_slab = (slab_size - first_offset) / object_size;
+	cache.objects_in_use = 0;
+	
+	//whole steps of whatever the objects leave over; a step keeps the first object aligned
+	uint32_t leftover = slab_size - first_offset - cache.objects_per_slab * object_size;
+	cache.color_step = (alignment > CACHE_LINE_SIZE) ? alignment : CACHE_LINE_SIZE;
+	cache.max_color = colored ? leftover - leftover % cache.color_step : 0;
+	cache.next_color = 0;
+	cache.section_backed = section_backed;
+	
+	cache.partial = SlabList{nullptr, 0};
+	cache.full = SlabList{nullptr, 0};
+	cache.empty = SlabList{nullptr, 0};
+}
+
+static void slab_list_push(SlabList &list, SlabHeader * slab){
+	slab->prev = nullptr;
+	slab->next = list.head;
+	if (list.head != nullptr){
+		list.head->prev = slab;
+	}
+	list.head = slab;
+	list.count++;
+}
+
+static void slab_list_remove(SlabList &list, SlabHeader * slab){
+	if (slab->prev != nullptr){
+		slab->prev->next = slab->next;
+	} else {
+		list.head = slab->next;
+	}
+	if (slab->next != nullptr){
+		slab->next->prev = slab->prev;
+	}
+	list.count--;
+}
+
+//a naturally aligned run of num_pages in some block, taking a new block if none has one
+static uintptr_t section_alloc(uint32_t num_pages){
+	uint32_t mask = (num_pages == 32) ? 0xffffffff : ((1u << num_pages) - 1);
+	
+	InterruptGuard guard;
+	auto lock = sections_spinlock_cs.acquire();
+	
+	SlabSection * section = sections;
+	for (; section != nullptr; section = section->next){
+		if (section->free_pages < num_pages){
+			continue;
+		}
+		
+		for (uint32_t first = 0; first < PAGES_IN_SECTION; first += num_pages){
+			uint32_t &word = section->used[first / 32];
+			uint32_t run_mask = mask << (first % 32);
+			
+			if ((word & run_mask) == 0){
+				word |= run_mask;
+				section->free_pages -= num_pages;
+				return (uintptr_t)section + first * PAGE_SIZE;
+			}
+		}
+	}
+	
+	//the block is section aligned, since PageAlloc aligns blocks to their size
+	section = (SlabSection*)slab_page_alloc->alloc(PAGES_IN_SECTION);
+	section->next = sections;
+	sections = section;
+	num_sections++;
+	
+	for (uint32_t &word : section->used){
+		word = 0;
+	}
+	
+	//the header's page, and the rest of the first run, which is too small for another slab of this size
+	uint32_t first = (num_pages > 1) ? num_pages : 1;
+	section->used[0] = 1;
+	section->used[first / 32] |= mask << (first % 32);
+	section->free_pages = PAGES_IN_SECTION - 1 - num_pages;
+	
+	return (uintptr_t)section + first * PAGE_SIZE;
+}
+
+static void section_free(uintptr_t page, uint32_t num_pages){
+	uint32_t mask = (num_pages == 32) ? 0xffffffff : ((1u << num_pages) - 1);
+	SlabSection * section = (SlabSection*)(page & ~(SECTION_SIZE - 1));
+	uint32_t first = (page - (uintptr_t)section) / PAGE_SIZE;
+	
+	//PageAlloc won't reset the frames when the pages are handed out again
+	slab_page_alloc->clear_page_flags(page, num_pages, PAGE_FRAME_SLAB);
+	slab_page_alloc->set_page_link(page, num_pages, NULL_PAGE_INDEX);
+	
+	InterruptGuard guard;
+	auto lock = sections_spinlock_cs.acquire();
+	
+	section->used[first / 32] &= ~(mask << (first % 32));
+	section->free_pages += num_pages;
+	
+	if (section->free_pages == PAGES_IN_SECTION - 1 && num_sections > 1){
+		SlabSection ** link = &sections;
+		while (*link != section){
+			link = &(*link)->next;
+		}
+		*link = section->next;
+		num_sections--;
+		
+		slab_page_alloc->ref_release_range((uintptr_t)section, PAGES_IN_SECTION);
+	}
+}
+
+void slab_sections_shrink(){
+	InterruptGuard guard;
+	auto lock = sections_spinlock_cs.acquire();
+	
+	if (num_sections == 1 && sections->free_pages == PAGES_IN_SECTION - 1){
+		slab_page_alloc->ref_release_range((uintptr_t)sections, PAGES_IN_SECTION);
+		sections = nullptr;
+		num_sections = 0;
+	}
+}
+
+uint32_t slab_get_num_sections(){
+	InterruptGuard guard;
+	auto lock = sections_spinlock_cs.acquire();
+	
+	return num_sections;
+}
+
+static void slab_release_pages(SlabCache &cache, uintptr_t page){
+	if (cache.section_backed){
+		section_free(page, cache.slab_pages);
+	} else {
+		slab_page_alloc->ref_release_range(page, cache.slab_pages);
+	}
+}
+
+//the cache's lock must be held
+static SlabHeader * slab_create(SlabCache &cache){
+	uintptr_t page = cache.section_backed ? section_alloc(cache.slab_pages) : slab_page_alloc->alloc(cache.slab_pages);
+	slab_page_alloc->set_page_flags(page, cache.slab_pages, PAGE_FRAME_SLAB);
+	if (cache.slab_pages > 1){
+		slab_page_alloc->set_page_link(page, cache.slab_pages, page / PAGE_SIZE);
+	}
+	
+	SlabHeader * slab = (SlabHeader*)page;
+	slab->cache = &cache;
+	slab->free_list = 0;
+	slab->in_use = 0;
+	
+	slab->color = cache.next_color;
+	cache.next_color = (cache.next_color >= cache.max_color) ? 0 : cache.next_color + cache.color_step;
+	slab->unused_offset = cache.first_offset + slab->color;
+	
+	return slab;
+}
+
+//the cache's lock must be held
+static void * slab_alloc_locked(SlabCache &cache){
+	SlabHeader * slab = cache.partial.head;
+	if (slab == nullptr){
+		slab = cache.empty.head;
+		if (slab != nullptr){
+			slab_list_remove(cache.empty, slab);
+		} else {
+			slab = slab_create(cache);
+		}
+		slab_list_push(cache.partial, slab);
+	}
+	
+	uintptr_t base = (uintptr_t)slab;
+	uint32_t offset;
+	
+	if (slab->free_list != 0){
+		offset = slab->free_list;
+		slab->free_list = *(uint32_t*)(base + offset);
+	} else {
+		offset = slab->unused_offset;
+		slab->unused_offset += cache.object_size;
+	}
+	
+	cache.objects_in_use++;
+	if (++slab->in_use == cache.objects_per_slab){
+		slab_list_remove(cache.partial, slab);
+		slab_list_push(cache.full, slab);
+	}
+	
+	return (void*)(base + offset);
+}
+
+//the cache's lock must be held
+static void slab_free_locked(SlabCache &cache, SlabHeader * slab, void * memory){
+	uintptr_t base = (uintptr_t)slab;
+	uint32_t offset = (uintptr_t)memory - base;
+	
+	*(uint32_t*)memory = slab->free_list;
+	slab->free_list = offset;
+	
+	cache.objects_in_use--;
+	if (slab->in_use-- == cache.objects_per_slab){
+		slab_list_remove(cache.full, slab);
+		slab_list_push(cache.partial, slab);
+	}
+	
+	if (slab->in_use == 0){
+		slab_list_remove(cache.partial, slab);
+		
+		if (cache.empty.count < SLAB_MAX_EMPTY){
+			//start the slab over, so that it is handed out in address order again
+			slab->free_list = 0;
+			slab->unused_offset = cache.first_offset + slab->color;
+			slab_list_push(cache.empty, slab);
+		} else {
+			slab_release_pages(cache, base);
+		}
+	}
+}
+
+void * slab_cache_alloc(SlabCache &cache){
+	InterruptGuard guard;
+	auto lock = cache.spinlock_cs.acquire();
+	
+	return slab_alloc_locked(cache);
+}
+
+void slab_cache_free(SlabHeader * slab, void * memory){
+	SlabCache &cache = *slab->cache;
+	
+	InterruptGuard guard;
+	auto lock = cache.spinlock_cs.acquire();
+	
+	slab_free_locked(cache, slab, memory);
+}
+
+void slab_cache_alloc_batch(SlabCache &cache, void ** objects, uint32_t count){
+	InterruptGuard guard;
+	auto lock = cache.spinlock_cs.acquire();
+	
+	for (uint32_t i = 0; i < count; i++){
+		objects[i] = slab_alloc_locked(cache);
+	}
+}
+
+void slab_cache_free_batch(SlabCache &cache, void * const * objects, uint32_t count){
+	InterruptGuard guard;
+	auto lock = cache.spinlock_cs.acquire();
+	
+	for (uint32_t i = 0; i < count; i++){
+		slab_free_locked(cache, slab_find(objects[i]), objects[i]);
+	}
+}
+
+void slab_cache_shrink(SlabCache &cache){
+	InterruptGuard guard;
+	auto lock = cache.spinlock_cs.acquire();
+	
+	while (cache.empty.head != nullptr){
+		SlabHeader * slab = cache.empty.head;
+		slab_list_remove(cache.empty, slab);
+		slab_release_pages(cache, (uintptr_t)slab);
+	}
+}
+
+SlabHeader * slab_find(void * memory){
+	uintptr_t page = (uintptr_t)memory & ~(PAGE_SIZE - 1);
+	
+	//get_page_frame would panic on a pointer outside RAM, before the caller could say what was wrong with it
+	if (page / PAGE_SIZE >= slab_page_alloc->get_num_pages()){
+		return nullptr;
+	}
+	
+	PageFrame frame = slab_page_alloc->get_page_frame(page);
+	
+	if (!(frame.flags & PAGE_FRAME_SLAB)){
+		return nullptr;
+	}
+	
+	//single-page slabs don't set the link
+	if (frame.link != NULL_PAGE_INDEX){
+		page = frame.link * PAGE_SIZE;
+	}
+	
+	return (SlabHeader*)page;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "common.h"
+#include "spinlock.h"
+#include "page_alloc.h"
+
+//slabs of fixed-size objects carved out of naturally aligned blocks from PageAlloc; kmalloc's size classes and
+//ObjectCache are both built on them
+
+const uint32_t CACHE_LINE_SIZE = 32; //ARM1176 L1 data cache
+
+//a slab with no objects in use is kept for reuse if its cache has fewer than this many, and returned to PageAlloc otherwise
+const uint32_t SLAB_MAX_EMPTY = 1;
+
+//slabs are doubled from their minimum size, up to this many pages, until no more than SLAB_MAX_WASTE_PERCENT of
+//the slab is left over after the header and the objects
+const uint32_t SLAB_MAX_PAGES = 32;
+const uint32_t SLAB_MAX_WASTE_PERCENT = 5;
+
+//free objects are linked through their first word by offset from the start of the slab, so that 4-byte objects
+//can hold a link on any target; offset 0 is the header, so it ends the list
+//the header is at the start of the slab's first page, and the frame of every page in a multi-page slab links to that page
+struct SlabCache;
+
+struct SlabHeader {
+	SlabHeader * prev;
+	SlabHeader * next;
+	SlabCache * cache;
+	uint32_t free_list;
+	uint32_t unused_offset; //objects from here to the end of the slab have never been handed out
+	uint32_t in_use;
+	uint32_t color; //bytes the first object is moved along by
+};
+
+//a section-backed cache carves its slabs out of whole 1 MiB blocks from PageAlloc, shared by every such cache, instead
+//of taking each slab from PageAlloc on its own; the blocks are section aligned, so each is one section descriptor
+//in the identity mapping and the slabs in it share one TLB entry, where slabs taken one by one end up spread over as
+//many sections as PageAlloc happened to find free pages in
+//the first page of each block holds its header; a block is returned to PageAlloc once it is empty, unless it is the
+//only one
+struct SlabSection {
+	SlabSection * next;
+	uint32_t free_pages;
+	uint32_t used[PAGES_IN_SECTION / 32]; //a bit for each page
+};
+
+struct SlabList {
+	SlabHeader * head;
+	uint32_t count;
+};
+
+//slabs move between the lists as their objects are allocated and freed; allocation only looks at the head of
+//partial (or empty), so both allocating and freeing are O(1)
+//a colored cache starts each new slab's objects a cache line (or the alignment, if that's more) further on than the
+//last one's, wrapping around within the space the objects leave over, so that the same object in different slabs
+//doesn't always land in the same cache set
+struct SlabCache {
+	Spinlock spinlock_cs;
+	uint32_t object_size;
+	uint32_t slab_pages;
+	uint32_t first_offset; //of the first object, after the header
+	uint32_t objects_per_slab;
+	uint32_t objects_in_use;
+	uint32_t color_step;
+	uint32_t max_color;
+	uint32_t next_color;
+	bool section_backed;
+	
+	SlabList partial;
+	SlabList full;
+	SlabList empty;
+};
+
+constexpr uint32_t slab_first_offset(size_t alignment){
+	return (sizeof(SlabHeader) + alignment - 1) & ~(alignment - 1);
+}
+
+constexpr uint32_t slab_get_num_pages(size_t object_size, size_t alignment, uint32_t min_pages){
+	uint32_t pages = min_pages;
+	
+	while (pages < SLAB_MAX_PAGES){
+		uint32_t slab_size = pages * PAGE_SIZE;
+		uint32_t waste = (slab_size - slab_first_offset(alignment)) % object_size + slab_first_offset(alignment);
+		
+		if (waste * 100 <= slab_size * SLAB_MAX_WASTE_PERCENT){
+			break;
+		}
+		pages *= 2;
+	}
+	
+	return pages;
+}
+
+void slab_init(PageAlloc &page_alloc);
+
+//the first object in a slab is aligned to alignment, so objects whose size is a multiple of it all are; slab_pages is a power of two
+void slab_cache_init(SlabCache &cache, uint32_t object_size, uint32_t slab_pages, uint32_t alignment, bool colored, bool section_backed = false);
+void * slab_cache_alloc(SlabCache &cache);
+void slab_cache_free(SlabHeader * slab, void * memory);
+void slab_cache_shrink(SlabCache &cache); //returns the cache's empty slabs to PageAlloc
+void slab_sections_shrink(); //returns the section-backed caches' last block to PageAlloc, if it is empty
+uint32_t slab_get_num_sections();
+
+//for callers that keep objects of their own in front of a cache: each call takes the cache's lock only once
+//the objects handed to slab_cache_free_batch must all be from cache
+void slab_cache_alloc_batch(SlabCache &cache, void ** objects, uint32_t count);
+void slab_cache_free_batch(SlabCache &cache, void * const * objects, uint32_t count);
+
+//the slab memory is in, or nullptr if it isn't in one (or isn't in RAM at all)
+SlabHeader * slab_find(void * memory);
@@ -0,0 +1,267 @@
+#include "runtime_benchmarks.h"
+#include "cpu.h"
+#include "kmalloc.h"
+#include "pmu.h"
+#include "slab.h"
+#include "uart.h"
+
+//the first object of each of a number of slabs is read over and over, as a list of hot objects that each came from a
+//different slab would be; uncolored, those objects are all at the same page offset and so share one set of the 4-way
+//L1 data cache, and once there are more of them than ways every read misses; colored, they're spread over as many
+//sets as the cache has colors
+//each slab is a different page, so the data micro TLB misses are the same either way and show the difference is in
+//the cache
+
+const uint32_t COLORING_BENCH_SIZES[] = {64, 120};
+const uint32_t COLORING_BENCH_SLABS[] = {4, 8, 16, 32};
+const uint32_t COLORING_BENCH_PASSES = 256;
+const uint32_t COLORING_BENCH_MAX_SLABS = 32;
+
+static PmuCounts walk_first_objects(uint32_t object_size, uint32_t num_slabs, bool colored, uint32_t * colors){
+	SlabCache cache;
+	slab_cache_init(cache, object_size, 1, CACHE_LINE_SIZE, colored);
+	*colors = cache.max_color / cache.color_step + 1;
+	
+	//fill whole slabs, keeping the first object of each
+	uint32_t num_objects = cache.objects_per_slab * num_slabs;
+	void ** objects = (void**)kmalloc(num_objects * sizeof(void*));
+	volatile uint32_t * first_objects[COLORING_BENCH_MAX_SLABS];
+	
+	for (uint32_t i = 0; i < num_objects; i++){
+		objects[i] = slab_cache_alloc(cache);
+		if (i % cache.objects_per_slab == 0){
+			first_objects[i / cache.objects_per_slab] = (volatile uint32_t*)objects[i];
+		}
+	}
+	
+	PmuCounts counts;
+	{
+		InterruptGuard guard;
+		
+		pmu_start(PmuEvent::DataCacheMiss, PmuEvent::DataMicroTlbMiss);
+		for (uint32_t pass = 0; pass < COLORING_BENCH_PASSES; pass++){
+			for (uint32_t i = 0; i < num_slabs; i++){
+				(void)*first_objects[i];
+			}
+		}
+		counts = pmu_read();
+		pmu_stop();
+	}
+	
+	for (uint32_t i = 0; i < num_objects; i++){
+		slab_cache_free(slab_find(objects[i]), objects[i]);
+	}
+	slab_cache_shrink(cache);
+	kfree(objects);
+	
+	return counts;
+}
+
+void bench_slab_coloring(){
+	uart_puts("slab coloring: D-cache misses / micro TLB misses / cycles for ");
+	uart_putdec(COLORING_BENCH_PASSES);
+	uart_puts(" reads of the first object of each slab\r\n");
+	
+	for (uint32_t object_size : COLORING_BENCH_SIZES){
+		for (uint32_t num_slabs : COLORING_BENCH_SLABS){
+			uint32_t colors;
+			PmuCounts uncolored = walk_first_objects(object_size, num_slabs, false, &colors);
+			PmuCounts colored = walk_first_objects(object_size, num_slabs, true, &colors);
+			
+			uart_putdec(object_size);
+			uart_puts(" bytes, ");
+			uart_putdec(num_slabs);
+			uart_puts(" slabs, ");
+			uart_putdec(colors);
+			uart_puts(" colors: uncolored ");
+			uart_putdec(uncolored.event0);
+			uart_puts(" / ");
+			uart_putdec(uncolored.event1);
+			uart_puts(" / ");
+			uart_putdec(uncolored.cycles);
+			uart_puts(", colored ");
+			uart_putdec(colored.event0);
+			uart_puts(" / ");
+			uart_putdec(colored.event1);
+			uart_puts(" / ");
+			uart_putdec(colored.cycles);
+			uart_putline();
+		}
+	}
+}
+
+//28-byte records read word by word, each allocated among others that aren't read, as records scattered through the
+//heap would be; from kmalloc, they're packed 28 bytes apart and many straddle two cache lines; from kmalloc_aligned,
+//each takes a line of its own
+const uint32_t ALIGNED_BENCH_RECORDS = 256;
+const uint32_t ALIGNED_BENCH_RECORD_SIZE = 28;
+const uint32_t ALIGNED_BENCH_STRIDE = 4; //objects allocated per record
+
+static PmuCounts walk_records(bool aligned){
+	void * objects[ALIGNED_BENCH_RECORDS * ALIGNED_BENCH_STRIDE];
+	
+	for (void * &object : objects){
+		object = aligned ? kmalloc_aligned(ALIGNED_BENCH_RECORD_SIZE, CACHE_LINE_SIZE) : kmalloc(ALIGNED_BENCH_RECORD_SIZE);
+	}
+	
+	PmuCounts counts;
+	{
+		InterruptGuard guard;
+
+#ifndef HOST_BUILD
+		//clean and invalidate the data cache, so that every record starts out cold
+		asm volatile("mcr p15, 0, %[zero], c7, c14, 0" : : [zero] "r" (0) : "memory");
+#endif
+
+		pmu_start(PmuEvent::DataCacheMiss, PmuEvent::DataCacheAccess);
+		for (uint32_t i = 0; i < ALIGNED_BENCH_RECORDS; i++){
+			volatile uint32_t * record = (volatile uint32_t*)objects[i * ALIGNED_BENCH_STRIDE];
+			
+			for (uint32_t j = 0; j < ALIGNED_BENCH_RECORD_SIZE / 4; j++){
+				(void)record[j];
+			}
+		}
+		counts = pmu_read();
+		pmu_stop();
+	}
+	
+	for (void * object : objects){
+		kfree(object);
+	}
+	
+	return counts;
+}
+
+void bench_kmalloc_aligned(){
+	PmuCounts unaligned = walk_records(false);
+	PmuCounts aligned = walk_records(true);
+	
+	uart_puts("kmalloc_aligned: D-cache misses / accesses walking ");
+	uart_putdec(ALIGNED_BENCH_RECORDS);
+	uart_puts(" 28-byte records: kmalloc ");
+	uart_putdec(unaligned.event0);
+	uart_puts(" / ");
+	uart_putdec(unaligned.event1);
+	uart_puts(", kmalloc_aligned ");
+	uart_putdec(aligned.event0);
+	uart_puts(" / ");
+	uart_putdec(aligned.event1);
+	uart_putline();
+}
+
+//objects read in a random order, as a list of them scattered through the heap would be: each holds a pointer to the
+//next, so nothing but the objects is read
+//first from slabs taken from PageAlloc one by one after it has aged, which is simulated by taking many sections and
+//giving back a page from each, so that the slabs land in as many different sections; then from a section-backed
+//cache, whose slabs all come from one or two blocks
+//the identity mapping covers RAM in sections, so the objects take a micro and a main TLB entry per section they're in
+const uint32_t SECTION_BENCH_OBJECTS = 4096;
+const uint32_t SECTION_BENCH_OBJECT_SIZE = 64;
+const uint32_t SECTION_BENCH_AGED_SECTIONS = 80;
+const uint32_t SECTION_BENCH_HOLE = 128; //the page given back from each aged section
+const uint32_t SECTION_BENCH_PASSES = 4;
+
+struct SectionBenchObject {
+	SectionBenchObject * next;
+};
+
+static PmuCounts walk_random_objects(bool section_backed, uint32_t * sections_used){
+	SlabCache cache;
+	slab_cache_init(cache, SECTION_BENCH_OBJECT_SIZE, 1, CACHE_LINE_SIZE, false, section_backed);
+	
+	SectionBenchObject ** objects = (SectionBenchObject**)kmalloc(SECTION_BENCH_OBJECTS * sizeof(SectionBenchObject*));
+	for (uint32_t i = 0; i < SECTION_BENCH_OBJECTS; i++){
+		objects[i] = (SectionBenchObject*)slab_cache_alloc(cache);
+	}
+	
+	//the sections touched, by index into RAM
+	uint32_t sections[32] = {0};
+	*sections_used = 0;
+	for (uint32_t i = 0; i < SECTION_BENCH_OBJECTS; i++){
+		uint32_t section = (uintptr_t)objects[i] / SECTION_SIZE;
+		if (section < 32 * 32 && !(sections[section / 32] & (1u << (section % 32)))){
+			sections[section / 32] |= 1u << (section % 32);
+			(*sections_used)++;
+		}
+	}
+	
+	//a random cycle through all of them (Fisher-Yates with an xorshift generator)
+	uint32_t random = 0x12345678;
+	for (uint32_t i = SECTION_BENCH_OBJECTS - 1; i > 0; i--){
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		uint32_t j = random % (i + 1);
+		
+		SectionBenchObject * swap = objects[i];
+		objects[i] = objects[j];
+		objects[j] = swap;
+	}
+	for (uint32_t i = 0; i < SECTION_BENCH_OBJECTS; i++){
+		objects[i]->next = objects[(i + 1) % SECTION_BENCH_OBJECTS];
+	}
+	
+	PmuCounts counts;
+	{
+		InterruptGuard guard;
+		
+		volatile SectionBenchObject * object = objects[0];
+		pmu_start(PmuEvent::DataMicroTlbMiss, PmuEvent::MainTlbMiss);
+		for (uint32_t i = 0; i < SECTION_BENCH_OBJECTS * SECTION_BENCH_PASSES; i++){
+			object = object->next;
+		}
+		counts = pmu_read();
+		pmu_stop();
+	}
+	
+	for (uint32_t i = 0; i < SECTION_BENCH_OBJECTS; i++){
+		slab_cache_free(slab_find(objects[i]), objects[i]);
+	}
+	slab_cache_shrink(cache);
+	kfree(objects);
+	
+	return counts;
+}
+
+void bench_section_heap(PageAlloc &page_alloc){
+	uintptr_t aged[SECTION_BENCH_AGED_SECTIONS];
+	
+	for (uintptr_t &section : aged){
+		section = page_alloc.alloc(PAGES_IN_SECTION);
+		page_alloc.ref_release_range(section + SECTION_BENCH_HOLE * PAGE_SIZE, 1);
+	}
+	
+	uint32_t page_sections;
+	PmuCounts page_backed = walk_random_objects(false, &page_sections);
+	
+	//the holes may have been taken by something else in the meantime, so only the rest of each section is released
+	for (uintptr_t section : aged){
+		page_alloc.ref_release_range(section, SECTION_BENCH_HOLE);
+		page_alloc.ref_release_range(section + (SECTION_BENCH_HOLE + 1) * PAGE_SIZE, PAGES_IN_SECTION - SECTION_BENCH_HOLE - 1);
+	}
+	
+	uint32_t arena_sections;
+	PmuCounts section_backed = walk_random_objects(true, &arena_sections);
+	
+	uart_puts("section heap: micro TLB misses / main TLB misses / cycles for ");
+	uart_putdec(SECTION_BENCH_OBJECTS * SECTION_BENCH_PASSES);
+	uart_puts(" random reads of ");
+	uart_putdec(SECTION_BENCH_OBJECTS);
+	uart_puts(" objects: page-backed slabs in ");
+	uart_putdec(page_sections);
+	uart_puts(" sections ");
+	uart_putdec(page_backed.event0);
+	uart_puts(" / ");
+	uart_putdec(page_backed.event1);
+	uart_puts(" / ");
+	uart_putdec(page_backed.cycles);
+	uart_puts(", section-backed in ");
+	uart_putdec(arena_sections);
+	uart_puts(" sections ");
+	uart_putdec(section_backed.event0);
+	uart_puts(" / ");
+	uart_putdec(section_backed.event1);
+	uart_puts(" / ");
+	uart_putdec(section_backed.cycles);
+	uart_putline();
+}
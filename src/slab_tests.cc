@@ -0,0 +1,227 @@
+#include "runtime_tests.h"
+#include "slab.h"
+#include "uart.h"
+#include "page_alloc.h"
+
+bool test_slab(PageAlloc &page_alloc) {
+	bool all_passed = true;
+	
+	//the loader runs its tests before there is a kmalloc to do this
+	slab_init(page_alloc);
+	
+	MemStats stats_i = page_alloc.get_mem_stats();
+	
+	uart_puts("Slab cache round trips objects: ");
+	{
+		SlabCache cache;
+		slab_cache_init(cache, 48, 1, CACHE_LINE_SIZE, false);
+		
+		//enough for two full slabs and part of a third
+		const uint32_t count = 2 * ((PAGE_SIZE - slab_first_offset(CACHE_LINE_SIZE)) / 48) + 1;
+		uint32_t * objects[count];
+		for (uint32_t i = 0; i < count; i++){
+			objects[i] = (uint32_t*)slab_cache_alloc(cache);
+			
+			SlabHeader * slab = slab_find(objects[i]);
+			all_passed &= slab != nullptr && slab->cache == &cache;
+			all_passed &= (uintptr_t)objects[i] % 16 == 0;
+			all_passed &= (uintptr_t)objects[i] >= (uintptr_t)slab + slab_first_offset(CACHE_LINE_SIZE);
+			all_passed &= (uintptr_t)objects[i] + 48 <= (uintptr_t)slab + PAGE_SIZE;
+			
+			for (uint32_t j = 0; j < 48 / sizeof(uint32_t); j++){
+				objects[i][j] = i;
+			}
+		}
+		
+		//nothing was handed out twice or overlaps anything else
+		for (uint32_t i = 0; i < count; i++){
+			for (uint32_t j = 0; j < 48 / sizeof(uint32_t); j++){
+				all_passed &= objects[i][j] == i;
+			}
+		}
+		
+		//a freed object is the next one handed out
+		slab_cache_free(slab_find(objects[5]), objects[5]);
+		all_passed &= slab_cache_alloc(cache) == objects[5];
+		
+		for (uint32_t i = 0; i < count; i++){
+			slab_cache_free(slab_find(objects[i]), objects[i]);
+		}
+		all_passed &= cache.objects_in_use == 0 && cache.partial.count == 0 && cache.full.count == 0;
+		all_passed &= cache.empty.count == SLAB_MAX_EMPTY;
+		
+		slab_cache_shrink(cache);
+		all_passed &= cache.empty.count == 0;
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Multi-page slabs are found from any of their pages: ");
+	{
+		SlabCache cache;
+		uint32_t slab_pages = slab_get_num_pages(1024, 64, 4);
+		slab_cache_init(cache, 1024, slab_pages, 64, false);
+		all_passed &= slab_pages >= 4 && cache.objects_per_slab > 3 * PAGE_SIZE / 1024;
+		
+		//one full slab: every object has to lead back to the header in the slab's first page
+		const uint32_t max_objects = SLAB_MAX_PAGES * PAGE_SIZE / 1024;
+		void * objects[max_objects];
+		uintptr_t header = 0;
+		for (uint32_t i = 0; i < cache.objects_per_slab; i++){
+			objects[i] = slab_cache_alloc(cache);
+			if (i == 0){
+				header = (uintptr_t)objects[i] & ~(slab_pages * PAGE_SIZE - 1);
+			}
+			
+			all_passed &= (uintptr_t)slab_find(objects[i]) == header;
+			all_passed &= (uintptr_t)objects[i] % 64 == 0;
+		}
+		all_passed &= (uintptr_t)objects[cache.objects_per_slab - 1] >= header + (slab_pages - 1) * PAGE_SIZE;
+		all_passed &= cache.full.count == 1;
+		
+		for (uint32_t i = 0; i < cache.objects_per_slab; i++){
+			slab_cache_free(slab_find(objects[i]), objects[i]);
+		}
+		slab_cache_shrink(cache);
+		
+		//the pages go back without the slab's flag or links
+		PageFrame frame = page_alloc.get_page_frame(header + PAGE_SIZE);
+		all_passed &= frame.refcount == 0 && !(frame.flags & PAGE_FRAME_SLAB) && frame.link == NULL_PAGE_INDEX;
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Colored slabs start their objects a step further on each: ");
+	{
+		SlabCache cache;
+		slab_cache_init(cache, 120, 1, CACHE_LINE_SIZE, true);
+		
+		uint32_t colors = cache.max_color / cache.color_step + 1;
+		all_passed &= colors > 1 && cache.color_step == CACHE_LINE_SIZE;
+		
+		//one slab more than there are colors, so the last one wraps around to the first color; less than an object is
+		//left over, so there are at most 120 / 32 + 1 colors
+		void * objects[5 * PAGE_SIZE / 120];
+		uint32_t count = 0;
+		
+		for (uint32_t s = 0; s <= colors; s++){
+			for (uint32_t i = 0; i < cache.objects_per_slab; i++){
+				objects[count] = slab_cache_alloc(cache);
+				
+				uintptr_t slab = (uintptr_t)slab_find(objects[count]);
+				all_passed &= (uintptr_t)objects[count] == slab + cache.first_offset + (s % colors) * cache.color_step + i * 120;
+				all_passed &= (uintptr_t)objects[count] + 120 <= slab + PAGE_SIZE;
+				count++;
+			}
+		}
+		all_passed &= count == (colors + 1) * cache.objects_per_slab && cache.full.count == colors + 1;
+		
+		for (uint32_t i = 0; i < count; i++){
+			slab_cache_free(slab_find(objects[i]), objects[i]);
+		}
+		slab_cache_shrink(cache);
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Section-backed slabs share sections and give them back: ");
+	{
+		all_passed &= slab_get_num_sections() == 0;
+		
+		//single-page slabs, and four-page ones that each hold a single object
+		SlabCache small;
+		SlabCache large;
+		slab_cache_init(small, 64, 1, CACHE_LINE_SIZE, false, true);
+		slab_cache_init(large, 4 * PAGE_SIZE - slab_first_offset(64), 4, 64, false, true);
+		all_passed &= large.objects_per_slab == 1;
+		
+		void * a = slab_cache_alloc(small);
+		uintptr_t section = (uintptr_t)slab_find(a) & ~(SECTION_SIZE - 1);
+		
+		//a section's first page is its header, and runs are naturally aligned after it
+		const uint32_t large_slabs = (PAGES_IN_SECTION - 4) / 4;
+		void * objects[2 * large_slabs];
+		for (uint32_t i = 0; i < large_slabs; i++){
+			objects[i] = slab_cache_alloc(large);
+			
+			uintptr_t slab = (uintptr_t)slab_find(objects[i]);
+			all_passed &= (slab & ~(SECTION_SIZE - 1)) == section && slab % (4 * PAGE_SIZE) == 0 && slab > section;
+		}
+		all_passed &= (uintptr_t)slab_find(a) == section + PAGE_SIZE;
+		all_passed &= slab_get_num_sections() == 1;
+		
+		//the section is full, so the next slab takes another
+		for (uint32_t i = large_slabs; i < 2 * large_slabs; i++){
+			objects[i] = slab_cache_alloc(large);
+		}
+		all_passed &= slab_get_num_sections() == 2;
+		
+		//a freed slab's pages are the next handed out
+		uintptr_t freed = (uintptr_t)slab_find(objects[3]);
+		slab_cache_free(slab_find(objects[3]), objects[3]);
+		slab_cache_shrink(large);
+		objects[3] = slab_cache_alloc(large);
+		all_passed &= (uintptr_t)slab_find(objects[3]) == freed;
+		
+		//an emptied section goes back to PageAlloc at once while there is another, and the last one on a shrink
+		for (uint32_t i = large_slabs; i < 2 * large_slabs; i++){
+			slab_cache_free(slab_find(objects[i]), objects[i]);
+		}
+		slab_cache_shrink(large);
+		all_passed &= slab_get_num_sections() == 1;
+		
+		for (uint32_t i = 0; i < large_slabs; i++){
+			slab_cache_free(slab_find(objects[i]), objects[i]);
+		}
+		slab_cache_free(slab_find(a), a);
+		slab_cache_shrink(large);
+		slab_cache_shrink(small);
+		all_passed &= slab_get_num_sections() == 1;
+		
+		slab_sections_shrink();
+		all_passed &= slab_get_num_sections() == 0;
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_puts("Slab lookup only finds slab memory: ");
+	{
+		uintptr_t page = page_alloc.alloc(1);
+		all_passed &= slab_find((void*)(page + 8)) == nullptr;
+		page_alloc.ref_release(page);
+		
+		//past the end of RAM, and in the kernel's virtual space
+		all_passed &= slab_find((void*)(page_alloc.get_num_pages() * PAGE_SIZE)) == nullptr;
+		all_passed &= slab_find((void*)0xfffff000) == nullptr;
+	}
+	if (all_passed) {
+		uart_puts("passed\r\n");
+	} else {
+		uart_puts("failed\r\n");
+	}
+	
+	uart_putline();
+	
+	MemStats stats_f = page_alloc.get_mem_stats();
+	
+	if (stats_i.usedmem != stats_f.usedmem){
+		uart_puts("Leaked ");
+		uart_puthex(stats_f.usedmem - stats_i.usedmem);
+		uart_puts(" bytes\r\n");
+		all_passed = false;
+	}
+	
+	return all_passed;
+}
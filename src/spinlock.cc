@@ -1,15 +1,25 @@
 #include "spinlock.h"
 
-Spinlock::HeldLockDummy::HeldLockDummy(Spinlock &_parent) :
+Spinlock::HeldLockDummy::HeldLockDummy(Spinlock * _parent) :
 	parent(_parent) {}
 
 Spinlock::HeldLockDummy::~HeldLockDummy() {
-	parent.flag.clear(std::memory_order_release);
+	if (parent){
+		parent->flag.clear(std::memory_order_release);
+	}
 }
 
 Spinlock::HeldLockDummy Spinlock::acquire() {
 	while (flag.test_and_set(std::memory_order_acquire)) {
 	}
 	
-	return Spinlock::HeldLockDummy(*this);
+	return Spinlock::HeldLockDummy(this);
+}
+
+Spinlock::HeldLockDummy Spinlock::try_acquire() {
+	if (flag.test_and_set(std::memory_order_acquire)) {
+		return Spinlock::HeldLockDummy(nullptr);
+	}
+	
+	return Spinlock::HeldLockDummy(this);
 }
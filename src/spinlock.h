@@ -10,14 +10,17 @@ public:
 	
 	class HeldLockDummy {
 		friend class Spinlock;
-		Spinlock &parent;
+		Spinlock * parent; //null if try_acquire failed
 		
-		HeldLockDummy(Spinlock &_parent);
+		HeldLockDummy(Spinlock * _parent);
 		
 	public:
 		~HeldLockDummy();
+		
+		explicit operator bool() const { return parent != nullptr; }
 	};
 	
 	HeldLockDummy acquire();
+	HeldLockDummy try_acquire(); //doesn't spin; check the result before touching what the lock protects
 };
 
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "common.h"
+
+//TLB maintenance after live descriptors have been changed
+//mappings aren't marked not-global, so an MVA invalidate matches them whatever the current ASID is, and they have to
+//be invalidated by MVA or all at once; invalidating by ASID only reaches not-global mappings
+//every call starts with a data synchronisation barrier, so the table walk sees the new descriptors, and ends with a
+//prefetch flush, so nothing fetched through the old translation is used; a range pays for them once
+//the descriptors don't need cleaning out of the data cache, since EnablePaging leaves it off
+
+//a range of more entries than this flushes the whole TLB instead: the ARM1176's main TLB only holds 64, so refilling
+//it costs less than invalidating them one by one
+const uint32_t TLB_RANGE_FLUSH_THRESHOLD = 64;
+
+inline void tlb_barrier() {
+#ifndef HOST_BUILD
+	asm volatile("mcr p15, 0, %[zero], c7, c10, 4" : : [zero] "r" (0) : "memory"); //data synchronisation barrier
+#endif
+}
+
+inline void tlb_prefetch_flush() {
+#ifndef HOST_BUILD
+	asm volatile("mcr p15, 0, %[zero], c7, c5, 4" : : [zero] "r" (0) : "memory");
+#endif
+}
+
+//for descriptors that have only just become valid: the TLB never holds a faulting translation, so there is nothing to
+//invalidate, only the barriers
+inline void tlb_sync() {
+	tlb_barrier();
+	tlb_prefetch_flush();
+}
+
+inline void tlb_invalidate_mva(uintptr_t virtual_address) {
+	tlb_barrier();
+#ifdef HOST_BUILD
+	(void)virtual_address;
+#else
+	asm volatile("mcr p15, 0, %[mva], c8, c7, 1" : : [mva] "r" (virtual_address & 0xfffff000) : "memory"); //invalidate unified TLB entry by MVA
+#endif
+	tlb_prefetch_flush();
+}
+
+inline void tlb_invalidate_asid(uint8_t asid) {
+	tlb_barrier();
+#ifdef HOST_BUILD
+	(void)asid;
+#else
+	asm volatile("mcr p15, 0, %[asid], c8, c7, 2" : : [asid] "r" ((uint32_t)asid) : "memory"); //invalidate unified TLB on ASID match
+#endif
+	tlb_prefetch_flush();
+}
+
+inline void tlb_invalidate_all() {
+	tlb_barrier();
+#ifndef HOST_BUILD
+	asm volatile("mcr p15, 0, %[zero], c8, c7, 0" : : [zero] "r" (0) : "memory"); //invalidate entire unified TLB
+#endif
+	tlb_prefetch_flush();
+}
+
+//entries translations of entry_size bytes each (a page, section or supersection: one MVA in each is enough to drop
+//its TLB entry), starting at start
+inline void tlb_invalidate_range(uintptr_t start, uint32_t entries, uint32_t entry_size) {
+	if (entries > TLB_RANGE_FLUSH_THRESHOLD){
+		tlb_invalidate_all();
+		return;
+	}
+	
+	tlb_barrier();
+#ifdef HOST_BUILD
+	(void)start;
+	(void)entry_size;
+#else
+	for (uint32_t i = 0; i < entries; i++){
+		asm volatile("mcr p15, 0, %[mva], c8, c7, 1" : : [mva] "r" ((start + i * entry_size) & 0xfffff000) : "memory");
+	}
+#endif
+	tlb_prefetch_flush();
+}
+
+//the maintenance one PageTable operation needs, done once it has changed all its descriptors rather than after each:
+//the scattered entries it changed are invalidated by MVA, or the whole TLB is if there are too many of them
+class TlbBatch {
+private:
+	uintptr_t addresses[TLB_RANGE_FLUSH_THRESHOLD];
+	uint32_t count;
+	bool flush_all;
+public:
+	TlbBatch() : count(0), flush_all(false) {}
+	TlbBatch(const TlbBatch &other) = delete;
+	
+	//a valid descriptor for the translation containing virtual_address has been changed or removed
+	void add(uintptr_t virtual_address) {
+		if (count == TLB_RANGE_FLUSH_THRESHOLD){
+			flush_all = true;
+		} else {
+			addresses[count++] = virtual_address;
+		}
+	}
+	
+	void finish() {
+		if (flush_all){
+			tlb_invalidate_all();
+		} else if (count > 0){
+			tlb_barrier();
+#ifndef HOST_BUILD
+			for (uint32_t i = 0; i < count; i++){
+				asm volatile("mcr p15, 0, %[mva], c8, c7, 1" : : [mva] "r" (addresses[i] & 0xfffff000) : "memory");
+			}
+#endif
+			tlb_prefetch_flush();
+		}
+		
+		count = 0;
+		flush_all = false;
+	}
+};
@@ -3,8 +3,12 @@
 
 /* Loop <delay> times in a way that the compiler won't optimize away. */
 void delay(int32_t count){
+#ifdef HOST_BUILD
+	(void)count;
+#else
 	asm volatile("__delay_%=: subs %[count], %[count], #1; bne __delay_%=\n"
 		 : : [count]"r"(count) : "cc");
+#endif
 }
 
 size_t strlen(const char* str){
@@ -44,6 +48,27 @@ void memset(uintptr_t dest, uint8_t ch, size_t count){
 	}
 }
 
+//clears a cache line (8 words) per iteration
+void memzero(uintptr_t dest, size_t count){
+#ifdef HOST_BUILD
+	__builtin_memset((void*)dest, 0, count);
+#else
+	asm volatile(
+		"mov r4, #0\n"
+		"mov r5, #0\n"
+		"mov r6, #0\n"
+		"mov r7, #0\n"
+		"__memzero_%=:\n"
+		"stmia %[dest]!, {r4-r7}\n"
+		"stmia %[dest]!, {r4-r7}\n"
+		"subs %[count], %[count], #32\n"
+		"bhi __memzero_%="
+		: [dest] "+r" (dest), [count] "+r" (count)
+		:
+		: "r4", "r5", "r6", "r7", "cc", "memory");
+#endif
+}
+
 /*void operator delete(void* ptr){
 	panic(PanicCodes::AssertionFailure);
 }
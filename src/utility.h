@@ -8,4 +8,5 @@ void delay(int32_t count);
 size_t strlen(const char* str);
 void memcpy(uintptr_t dest, uintptr_t src, size_t count);
 void memset(uintptr_t dest, uint8_t ch, size_t count);
+void memzero(uintptr_t dest, size_t count); //dest and count must be non-zero multiples of 32
 